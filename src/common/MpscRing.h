@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 多生产者单消费者环形队列
+ *
+ * 创建于 2026年10月19日
+ *
+ * 容量固定、无锁（Vyukov 有界队列）。每个槽带一个序号：
+ * 序号等于写入位置时可写，等于写入位置 + 1 时可读，读完后加上容量，留给下一轮写入。
+ * 生产者只用一次 CAS 抢占写入位置，消费者不需要原子读改写。
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace vesper::common {
+
+template<typename T, size_t CAPACITY>
+class MpscRing {
+
+    static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of 2.");
+
+public:
+
+    MpscRing() {
+        for (size_t i = 0; i < CAPACITY; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator = (const MpscRing&) = delete;
+
+    /**
+     * 可在任意线程调用。
+     *
+     * @param fill 以 T& 为参数，就地写入元素。
+     * @return 队列已满时返回 false，不调用 fill。
+     */
+    template<typename Fill>
+    bool push(Fill&& fill) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        while (true) {
+            cell = &cells[pos & (CAPACITY - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        fill(cell->value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * 只能在消费者线程调用。
+     *
+     * @param consume 以 T& 为参数。返回后该槽即可被重新写入。
+     * @return 队列为空，或最早的元素还没有写完时返回 false。
+     */
+    template<typename Consume>
+    bool pop(Consume&& consume) {
+        Cell& cell = cells[dequeuePos & (CAPACITY - 1)];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+        if (intptr_t(sequence) - intptr_t(dequeuePos + 1) < 0) {
+            return false;
+        }
+
+        consume(cell.value);
+        cell.sequence.store(dequeuePos + CAPACITY, std::memory_order_release);
+        dequeuePos++;
+        return true;
+    }
+
+    /**
+     * 只能在消费者线程调用。
+     *
+     * @return 没有任何生产者占用过的槽时返回 true。已占用但还没有写完的元素也算在内。
+     */
+    bool empty() const {
+        return enqueuePos.load(std::memory_order_acquire) == dequeuePos;
+    }
+
+protected:
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    Cell cells[CAPACITY];
+
+    alignas(64) std::atomic<size_t> enqueuePos {0};
+    alignas(64) size_t dequeuePos = 0;
+
+};
+
+} // namespace vesper::common
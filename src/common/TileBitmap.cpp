@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 分块脏区位图
+ *
+ * 创建于 2026年10月18日
+ */
+
+#include "./TileBitmap.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace vesper::bindings;
+
+namespace vesper::common {
+
+
+void TileBitmap::resize(int width, int height) {
+    pixelWidth = max(width, 0);
+    pixelHeight = max(height, 0);
+
+    tileColumns = (pixelWidth + TILE_SIZE - 1) / TILE_SIZE;
+    tileRows = (pixelHeight + TILE_SIZE - 1) / TILE_SIZE;
+    wordsPerRow = (tileColumns + 63) / 64;
+
+    size_t count = size_t(wordsPerRow) * tileRows;
+    words.assign(count + (count & 1), 0);
+}
+
+
+void TileBitmap::clear() {
+    fill(words.begin(), words.end(), 0);
+}
+
+
+void TileBitmap::setAll() {
+    clear();
+    addRect(0, 0, pixelWidth, pixelHeight);
+}
+
+
+bool TileBitmap::empty() const {
+    for (auto word : words) {
+        if (word) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void TileBitmap::addRect(int x1, int y1, int x2, int y2) {
+    x1 = max(x1, 0);
+    y1 = max(y1, 0);
+    x2 = min(x2, pixelWidth);
+    y2 = min(y2, pixelHeight);
+
+    if (x1 >= x2 || y1 >= y2) {
+        return;
+    }
+
+    int column1 = x1 / TILE_SIZE;
+    int column2 = (x2 - 1) / TILE_SIZE;
+    int row1 = y1 / TILE_SIZE;
+    int row2 = (y2 - 1) / TILE_SIZE;
+
+    for (int row = row1; row <= row2; row++) {
+        for (int column = column1; column <= column2; column++) {
+            set(column, row);
+        }
+    }
+}
+
+
+void TileBitmap::addRegion(const pixman::Region32& region) {
+    int nRects;
+    const pixman_box32_t* rects = region.rectangles(&nRects);
+    for (int i = 0; i < nRects; i++) {
+        auto& it = rects[i];
+        addRect(it.x1, it.y1, it.x2, it.y2);
+    }
+}
+
+
+void TileBitmap::toRegion(pixman::Region32& region) const {
+    region.clear();
+
+    forEachRun([&] (int row, int column, int end) {
+        region += (pixman_box32_t) {
+            .x1 = column * TILE_SIZE,
+            .y1 = row * TILE_SIZE,
+            .x2 = min(end * TILE_SIZE, pixelWidth),
+            .y2 = min((row + 1) * TILE_SIZE, pixelHeight)
+        };
+    });
+}
+
+
+int TileBitmap::nextSet(int row, int column) const {
+    while (column < tileColumns) {
+        uint64_t word = words[wordIndex(column, row)] >> (column & 63);
+        if (word) {
+            return min(column + __builtin_ctzll(word), tileColumns);
+        }
+
+        column = (column | 63) + 1;
+    }
+
+    return tileColumns;
+}
+
+
+int TileBitmap::nextUnset(int row, int column) const {
+    while (column < tileColumns) {
+        uint64_t word = ~words[wordIndex(column, row)] >> (column & 63);
+        if (word) {
+            return min(column + __builtin_ctzll(word), tileColumns);
+        }
+
+        column = (column | 63) + 1;
+    }
+
+    return tileColumns;
+}
+
+
+/*
+ * 位运算。words 长度总是偶数，可以直接按 128 位处理。
+ */
+
+
+TileBitmap& TileBitmap::operator |= (const TileBitmap& other) {
+    if (!sameShape(other)) {
+        setAll();
+        return *this;
+    }
+
+    size_t count = words.size();
+    uint64_t* dst = words.data();
+    const uint64_t* src = other.words.data();
+
+#if defined(__SSE2__)
+    for (size_t i = 0; i < count; i += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_or_si128(a, b));
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        dst[i] |= src[i];
+    }
+#endif
+
+    return *this;
+}
+
+
+TileBitmap& TileBitmap::operator &= (const TileBitmap& other) {
+    if (!sameShape(other)) {
+        clear();
+        return *this;
+    }
+
+    size_t count = words.size();
+    uint64_t* dst = words.data();
+    const uint64_t* src = other.words.data();
+
+#if defined(__SSE2__)
+    for (size_t i = 0; i < count; i += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_and_si128(a, b));
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        dst[i] &= src[i];
+    }
+#endif
+
+    return *this;
+}
+
+
+void TileBitmap::subtract(const TileBitmap& other) {
+    if (!sameShape(other)) {
+        return;
+    }
+
+    size_t count = words.size();
+    uint64_t* dst = words.data();
+    const uint64_t* src = other.words.data();
+
+#if defined(__SSE2__)
+    for (size_t i = 0; i < count; i += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_andnot_si128(b, a));
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        dst[i] &= ~src[i];
+    }
+#endif
+}
+
+
+} // namespace vesper::common
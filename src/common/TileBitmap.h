@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 分块脏区位图
+ *
+ * 创建于 2026年10月18日
+ *
+ * 把画面切成固定大小的块，每块用一个比特表示是否被 damage。
+ * 与 pixman 区域相比，合并与求交的开销只与画面大小有关，不受 damage 碎片程度影响。
+ * 只在导出管线的两端与 pixman::Region32 互相转换。
+ */
+
+#pragma once
+
+#include "../bindings/pixman.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace vesper::common {
+
+class TileBitmap {
+
+public:
+
+    static constexpr int TILE_SIZE = 64;
+
+    /**
+     * 设置画面尺寸。会清空所有块。
+     */
+    void resize(int width, int height);
+
+    int width() const { return pixelWidth; }
+    int height() const { return pixelHeight; }
+    int columns() const { return tileColumns; }
+    int rows() const { return tileRows; }
+
+    void clear();
+    void setAll();
+    bool empty() const;
+
+    inline bool test(int column, int row) const {
+        return (words[wordIndex(column, row)] >> (column & 63)) & 1;
+    }
+
+    inline void set(int column, int row) {
+        words[wordIndex(column, row)] |= uint64_t(1) << (column & 63);
+    }
+
+    inline void reset(int column, int row) {
+        words[wordIndex(column, row)] &= ~(uint64_t(1) << (column & 63));
+    }
+
+    /**
+     * 标记与矩形 [x1, x2) x [y1, y2) 相交的所有块。
+     */
+    void addRect(int x1, int y1, int x2, int y2);
+
+    void addRegion(const vesper::bindings::pixman::Region32& region);
+
+    /**
+     * 转换为 pixman 区域。每行中连续的块会合并为一个矩形。
+     */
+    void toRegion(vesper::bindings::pixman::Region32& region) const;
+
+    /**
+     * 逐行遍历连续的脏块。
+     *
+     * @param callback 参数为 (row, firstColumn, lastColumn + 1)。
+     */
+    template<typename Callback>
+    void forEachRun(Callback callback) const {
+        for (int row = 0; row < tileRows; row++) {
+            int column = 0;
+            while (column < tileColumns) {
+                column = nextSet(row, column);
+                if (column >= tileColumns) {
+                    break;
+                }
+
+                int end = nextUnset(row, column);
+                callback(row, column, end);
+                column = end;
+            }
+        }
+    }
+
+    /** 尺寸不同时，保守地认为所有块都脏了。 */
+    TileBitmap& operator |= (const TileBitmap& other);
+
+    /** 尺寸不同时，没有可以确定的公共块，清空。 */
+    TileBitmap& operator &= (const TileBitmap& other);
+
+    /** 去掉 other 中被标记的块。尺寸不同时，保持不变。 */
+    void subtract(const TileBitmap& other);
+
+protected:
+
+    inline size_t wordIndex(int column, int row) const {
+        return size_t(row) * wordsPerRow + (column >> 6);
+    }
+
+    /** 从 column 开始，找到本行第一个被标记的块。没有时返回 columns()。 */
+    int nextSet(int row, int column) const;
+
+    /** 从 column 开始，找到本行第一个未被标记的块。没有时返回 columns()。 */
+    int nextUnset(int row, int column) const;
+
+    bool sameShape(const TileBitmap& other) const {
+        return tileColumns == other.tileColumns && tileRows == other.tileRows;
+    }
+
+protected:
+
+    int pixelWidth = 0;
+    int pixelHeight = 0;
+    int tileColumns = 0;
+    int tileRows = 0;
+    int wordsPerRow = 0;
+
+    /** 按行存放。长度补齐为偶数，便于按 128 位处理。 */
+    std::vector<uint64_t> words;
+
+};
+
+} // namespace vesper::common
@@ -21,6 +21,7 @@
     macro(TerminateVesper) \
     macro(GetVNCPort) \
     macro(GetVNCPassword) \
+    macro(GetThumbnail) \
     macro(GetVesperVersion)
 
 
@@ -94,6 +95,17 @@ protected:
 };
 
 
+class GetThumbnail : public Base {
+public:
+    static const uint32_t typeCode = 0x0103;
+    VESPER_CTRL_PROTO_DECL_GET_TYPE()
+
+
+protected:
+
+};
+
+
 class GetVesperVersion : public Base {
 public:
     static const uint32_t typeCode = 0x0201;
@@ -309,6 +309,19 @@ int Server::processGetVNCPassword(protocol::GetVNCPassword*, int connFd) {
 }
 
 
+int Server::processGetThumbnail(protocol::GetThumbnail*, int connFd) {
+
+    string jpeg;
+    if (options.hooks.getThumbnail && options.hooks.getThumbnail(jpeg)) {
+        sendResponse(connFd, 0, jpeg);
+    } else {
+        sendResponse(connFd, -1, "thumbnail is not available");
+    }
+
+    return 1;
+}
+
+
 int Server::processGetVesperVersion(protocol::GetVesperVersion*, int connFd) {
     stringstream ss;
 
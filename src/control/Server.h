@@ -40,6 +40,7 @@ public:
             std::function<void ()> terminateVesper;
             std::function<const int ()> getVNCPort;
             std::function<const std::string& ()> getVNCPassword;
+            std::function<bool (std::string& jpeg)> getThumbnail;
         } hooks = {0};
 
         struct {
@@ -74,6 +75,7 @@ protected:
     int processTerminateVesper(protocol::TerminateVesper*, int connFd);
     int processGetVNCPort(protocol::GetVNCPort*, int connFd);
     int processGetVNCPassword(protocol::GetVNCPassword*, int connFd);
+    int processGetThumbnail(protocol::GetThumbnail*, int connFd);
     int processGetVesperVersion(protocol::GetVesperVersion*, int connFd);
 
 protected:
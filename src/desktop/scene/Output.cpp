@@ -19,6 +19,8 @@
 
 #include <semaphore>
 #include <thread>
+#include <algorithm>
+#include <cstdint>
 
 using namespace std;
 using namespace vesper::bindings;
@@ -37,10 +39,19 @@ static void outputCommitEventBridge(wl_listener* listener, void* data) {
         WLR_OUTPUT_STATE_SUBPIXEL
     );
 
-    if (
-        forceUpdate 
-        || (state->committed & (WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_ENABLED))
-    ) {
+    bool geometryChanged = forceUpdate || (state->committed & WLR_OUTPUT_STATE_ENABLED);
+
+    if (state->committed & WLR_OUTPUT_STATE_MODE) {
+        auto& resolution = output->committedResolution;
+        geometryChanged = geometryChanged
+            || resolution.width != output->wlrOutput->width
+            || resolution.height != output->wlrOutput->height;
+    }
+
+    output->committedResolution.width = output->wlrOutput->width;
+    output->committedResolution.height = output->wlrOutput->height;
+
+    if (geometryChanged) {
         output->updateGeometry(forceUpdate);
     }
 
@@ -51,6 +62,23 @@ static void outputCommitEventBridge(wl_listener* listener, void* data) {
             output->pendingCommitDamage += state->damage;
         }
     }
+
+    // 本次提交之前采样的窗口，等这次提交显示出来后再发送 presentation 反馈。
+
+    if (state->committed & WLR_OUTPUT_STATE_BUFFER) {
+        for (auto& it : output->presentationFeedbacks) {
+            if (!it.committed) {
+                it.committed = true;
+                it.commitSeq = output->wlrOutput->commit_seq;
+            }
+        }
+    }
+}
+
+
+static void outputPresentEventBridge(wl_listener* listener, void* data) {
+    Output* output = wl_container_of(listener, output, eventListeners.outputPresent);
+    output->presented((wlr_output_event_present*) data);
 }
 
 
@@ -70,6 +98,17 @@ static void outputNeedsFrameEventBridge(wl_listener* listener, void* data) {
 }
 
 
+static int occludedFrameTimerBridge(void* data) {
+    auto* output = (Output*) data;
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    output->sendFrameDone(&now, true);
+
+    return 0;
+}
+
+
 static void outputDestroyEventBridge(wlr_addon* addon) {
     Output* output = wl_container_of(addon, output, addon);
     delete output;
@@ -92,6 +131,8 @@ int Output::init(const CreateOptions& options) {
     this->alwaysRenderEntireScreen = options.alwaysRenderEntireScreen;
     this->exportScreenBuffer = options.exportScreenBuffer;
     this->forceRenderSoftwareCursor = options.forceRenderSoftwareCursor;
+    this->renderOnDemand = options.renderOnDemand;
+    this->occludedFrameRate = options.occludedFrameRate;
 
     wlr_addon_init(&this->addon, &wlrOutput->addons, scene, &sceneOutputAddonImpl);
     
@@ -125,6 +166,18 @@ int Output::init(const CreateOptions& options) {
     eventListeners.outputNeedsFrame.notify = outputNeedsFrameEventBridge;
     wl_signal_add(&wlrOutput->events.needs_frame, &eventListeners.outputNeedsFrame);
 
+    eventListeners.outputPresent.notify = outputPresentEventBridge;
+    wl_signal_add(&wlrOutput->events.present, &eventListeners.outputPresent);
+
+    committedResolution.width = wlrOutput->width;
+    committedResolution.height = wlrOutput->height;
+
+    if (occludedFrameRate > 0) {
+        occludedFrameTimer = wl_event_loop_add_timer(
+            wlrOutput->event_loop, occludedFrameTimerBridge, this
+        );
+    }
+
     this->updateGeometry(false);
 
     return 0;
@@ -163,10 +216,59 @@ void Output::updateGeometry(bool forceUpdate, bool dontTouchTreeAndFrame) {
 }
 
 void Output::scheduleFrame() {
+    if (renderOnDemand && !frameDemand) {
+        frameDeferred = true;
+        return;
+    }
+
     wlr_output_schedule_frame(this->wlrOutput);
 }
 
 
+void Output::demandFrames(bool demand) {
+    frameDemand = demand;
+
+    if (frameDemand && frameDeferred) {
+        frameDeferred = false;
+        wlr_output_schedule_frame(this->wlrOutput);
+    }
+}
+
+
+void Output::recordDamagedFrame(int64_t nowNsec) {
+    auto& stats = damageStats;
+
+    if (stats.lastFrameNsec > 0) {
+        int64_t intervalNsec = max(nowNsec - stats.lastFrameNsec, int64_t(1000000));
+        double fps = 1000000000.0 / intervalNsec;
+        stats.framesPerSec = stats.framesPerSec * 0.75 + fps * 0.25;
+    }
+
+    stats.lastFrameNsec = nowNsec;
+}
+
+
+double Output::damageRate(int64_t nowNsec) const {
+    if (damageStats.lastFrameNsec == 0) {
+        return 0;
+    }
+
+    // 平均值只在出现 damage 时更新。空闲得越久，实际频率越低。
+
+    int64_t idleNsec = max(nowNsec - damageStats.lastFrameNsec, int64_t(1000000));
+    return min(damageStats.framesPerSec, 1000000000.0 / idleNsec);
+}
+
+
+int64_t Output::damageIdleNsec(int64_t nowNsec) const {
+    if (damageStats.lastFrameNsec == 0) {
+        return INT64_MAX;
+    }
+
+    return nowNsec - damageStats.lastFrameNsec;
+}
+
+
 bool Output::commit(StateOptions* options) {
     
     if (!wlrOutput->needs_frame && pendingCommitDamage.empty()) {
@@ -442,6 +544,65 @@ static void forceRenderSoftwareCursorToRenderPass(
 }
 
 
+/**
+ * 计算节点确定不透明的区域。
+ * 
+ * 与 SceneNode::opaqueRegion 不同，这里只相信客户端声明的不透明区域，
+ * 因为 bufferIsOpaque 目前并不可靠。
+ */
+static void nodeOccluderRegion(SceneNode* node, int x, int y, pixman::Region32& res) {
+    int width, height;
+    node->getSize(&width, &height);
+
+    if (node->type() == SceneNodeType::RECT) {
+        auto* rect = (SceneRectNode*) node;
+        if (rect->color[3] == 1) {
+            res = (wlr_box) { .x = x, .y = y, .width = width, .height = height };
+        }
+    } else if (node->type() == SceneNodeType::BUFFER) {
+        auto* buf = (SceneBufferNode*) node;
+        if (buf->wlrBuffer && buf->opacity == 1) {
+            res.intersectRect(buf->opaqueRegion, 0, 0, width, height);
+            res.translate(x, y);
+        }
+    }
+}
+
+
+/**
+ * 计算内容类型为视频或游戏的窗口在本帧中实际露出的区域（输出 buffer 坐标）。
+ */
+static void collectVideoRegion(
+    Output* output, const RenderData& data, size_t nodeCount, pixman::Region32& res
+) {
+    res.clear();
+    
+    pixman::Region32 covered;
+
+    for (size_t i = 0; i < nodeCount; i++) {
+        auto& entry = output->renderList[i];
+        SceneNode* node = entry.node;
+
+        if (node->type() == SceneNodeType::BUFFER) {
+            auto type = ((SceneBufferNode*) node)->contentType;
+            if (type == ContentType::VIDEO || type == ContentType::GAME) {
+                pixman::Region32 exposed;
+                exposed.subtract(node->visibleArea, covered);
+                res += exposed;
+            }
+        }
+
+        pixman::Region32 opaque;
+        nodeOccluderRegion(node, entry.x, entry.y, opaque);
+        covered += opaque;
+    }
+
+    pixman_region32_translate(res.raw(), -data.logical.x, -data.logical.y);
+    scaleOutputDamage(res.raw(), data.scale);
+    transformOutputDamage(res.raw(), &data);
+}
+
+
 bool Output::buildState(wlr_output_state* state, StateOptions* options) {
 
     if (alwaysRenderEntireScreen) {
@@ -449,7 +610,8 @@ bool Output::buildState(wlr_output_state* state, StateOptions* options) {
     }
 
     StateOptions defaultOptions = {
-        .timer = nullptr
+        .timer = nullptr,
+        .refreshMilliHz = 0
     };
 
     if (!options) {
@@ -475,6 +637,22 @@ bool Output::buildState(wlr_output_state* state, StateOptions* options) {
         return true; // 对于已经 disable 的状态，不用处理。
     }
 
+    if (pixman_region32_not_empty(&wlrDamageRing.current)) {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        recordDamagedFrame(timespecToNsec(&now));
+    }
+
+    if (
+        options->refreshMilliHz > 0 
+        && options->refreshMilliHz != wlrOutput->refresh
+        && !(state->committed & WLR_OUTPUT_STATE_MODE)
+    ) {
+        wlr_output_state_set_custom_mode(
+            state, wlrOutput->width, wlrOutput->height, options->refreshMilliHz
+        );
+    }
+
     RenderData renderData = {
         .transform = wlrOutput->transform,
         .scale = wlrOutput->scale,
@@ -642,8 +820,10 @@ bool Output::buildState(wlr_output_state* state, StateOptions* options) {
 
     wlr_output_state_set_buffer(state, buffer);
 
+    collectVideoRegion(this, renderData, listCon.nodeCount, this->videoRegion);
+
     if (exportScreenBuffer) {
-        this->framebufferPlate.put(buffer, renderData.damage, true);
+        this->framebufferPlate.put(buffer, renderData.damage, videoRegion, true);
     } else {
         wlr_buffer_unlock(buffer);
     }
@@ -652,8 +832,171 @@ bool Output::buildState(wlr_output_state* state, StateOptions* options) {
 }  // bool Output::buildState(wlr_output_state* state, StateOptions* options)
 
 
-void Output::sendFrameDone(timespec* now) {
-    this->scene->tree->sendFrameDone(this, now);
+struct FrameDoneIteratorData {
+    Output* output;
+    timespec* now;
+    int64_t nowNsec;
+    
+    /** 降频间隔（纳秒）。0 表示不向被遮挡的窗口发送。 */
+    int64_t occludedIntervalNsec;
+    bool occludedOnly;
+
+    /** 上层不透明内容已经盖住的区域（布局坐标）。 */
+    pixman::Region32 covered;
+
+    /** 最近一个被降频的窗口还需要等待多久（纳秒）。 */
+    int64_t nextThrottledNsec;
+};
+
+
+static bool sendFrameDoneIterator(SceneNode* node, int x, int y, void* untypedData) {
+    auto* data = (FrameDoneIteratorData*) untypedData;
+
+    if (node->invisible()) {
+        return false;
+    }
+
+    if (node->type() == SceneNodeType::BUFFER) {
+        auto* buf = (SceneBufferNode*) node;
+
+        // 完全被遮挡的窗口没有 primaryOutput，按它最后所在的输出处理。
+
+        Output* output = buf->primaryOutput ? buf->primaryOutput : buf->lastPrimaryOutput;
+
+        if (output == data->output) {
+            pixman::Region32 exposed;
+            exposed.subtract(buf->visibleArea, data->covered);
+
+            bool occluded = exposed.empty();
+            bool send = !occluded && !data->occludedOnly;
+
+            if (occluded && data->occludedIntervalNsec > 0) {
+                int64_t waited = data->nowNsec - buf->lastFrameDoneNsec;
+                if (waited >= data->occludedIntervalNsec) {
+                    send = true;
+                    waited = 0;
+                }
+
+                data->nextThrottledNsec = min(
+                    data->nextThrottledNsec, data->occludedIntervalNsec - waited
+                );
+            }
+
+            if (send) {
+                buf->lastFrameDoneNsec = data->nowNsec;
+                wl_signal_emit_mutable(&buf->events.frameDone, data->now);
+            }
+        }
+    }
+
+    pixman::Region32 opaque;
+    nodeOccluderRegion(node, x, y, opaque);
+    data->covered += opaque;
+
+    return false;
+}
+
+
+void Output::sendFrameDone(timespec* now, bool occludedOnly) {
+    FrameDoneIteratorData data = {
+        .output = this,
+        .now = now,
+        .nowNsec = timespecToNsec(now),
+        .occludedIntervalNsec = occludedFrameRate > 0 ? 1000000000ll / occludedFrameRate : 0,
+        .occludedOnly = occludedOnly,
+        .nextThrottledNsec = INT64_MAX
+    };
+
+    wlr_box box = {
+        .x = position.x,
+        .y = position.y
+    };
+
+    wlr_output_effective_resolution(wlrOutput, &box.width, &box.height);
+
+    // nodesInBox 从最上层开始遍历，因此可以边遍历边累积遮挡区域。
+
+    this->scene->tree->nodesInBox(&box, sendFrameDoneIterator, &data);
+
+    if (occludedFrameTimer && data.nextThrottledNsec != INT64_MAX) {
+        int delayMsec = max(int(data.nextThrottledNsec / 1000000), 1);
+        wl_event_source_timer_update(occludedFrameTimer, delayMsec);
+    }
+}
+
+
+/** wp_presentation_feedback.kind 中的 zero_copy。 */
+static constexpr uint32_t PRESENTATION_KIND_ZERO_COPY = 0x8;
+
+
+void Output::addPresentationFeedback(wlr_surface* surface) {
+    wlr_presentation_feedback* feedback = wlr_presentation_surface_sampled(surface);
+    if (feedback == nullptr) {
+        return;  // 客户端没有请求反馈。
+    }
+
+    presentationFeedbacks.push_back({
+        .feedback = feedback,
+        .committed = false,
+        .commitSeq = 0
+    });
+}
+
+
+void Output::presented(wlr_output_event_present* event) {
+
+    // headless 后端不填写刷新周期和 vblank 序号，按虚拟刷新周期补上。
+    // 序号按两次显示之间经过的刷新周期数递增，刷新率变化时也不会回退。
+
+    uint32_t refreshNsec = event->refresh > 0 ? uint32_t(event->refresh) : 0;
+    if (refreshNsec == 0 && wlrOutput->refresh > 0) {
+        refreshNsec = uint32_t(1000000000000ll / wlrOutput->refresh);
+    }
+
+    if (event->presented) {
+        int64_t whenNsec = event->when ? timespecToNsec(event->when) : 0;
+
+        if (lastPresentNsec > 0 && refreshNsec > 0 && whenNsec > lastPresentNsec) {
+            int64_t elapsed = whenNsec - lastPresentNsec;
+            presentSeq += max<int64_t>(1, (elapsed + refreshNsec / 2) / refreshNsec);
+        } else {
+            presentSeq++;
+        }
+
+        lastPresentNsec = whenNsec;
+    }
+
+    // 只处理与这次显示对应的提交。更早的提交已经不会再显示。
+
+    auto it = presentationFeedbacks.begin();
+    while (it != presentationFeedbacks.end()) {
+        if (!it->committed || int32_t(it->commitSeq - event->commit_seq) > 0) {
+            it++;
+            continue;
+        }
+
+        if (event->presented && it->commitSeq == event->commit_seq) {
+            wlr_presentation_event presentationEvent = {};
+            wlr_presentation_event_from_output(&presentationEvent, event);
+
+            if (presentationEvent.refresh == 0) {
+                presentationEvent.refresh = refreshNsec;
+            }
+
+            if (presentationEvent.seq == 0) {
+                presentationEvent.seq = presentSeq;
+            }
+
+            // 窗口内容经过合成，不是直接扫描输出。
+
+            presentationEvent.flags &= ~PRESENTATION_KIND_ZERO_COPY;
+
+            wlr_presentation_feedback_send_presented(it->feedback, &presentationEvent);
+        }
+
+        wlr_presentation_feedback_destroy(it->feedback);
+        it = presentationFeedbacks.erase(it);
+    }
 }
 
 
@@ -665,6 +1008,11 @@ Output::~Output() {
 
     // todo: highlight region
 
+    if (occludedFrameTimer) {
+        wl_event_source_remove(occludedFrameTimer);
+        occludedFrameTimer = nullptr;
+    }
+
     wlr_addon_finish(&this->addon);
     wlr_damage_ring_finish(&wlrDamageRing);
 
@@ -672,6 +1020,13 @@ Output::~Output() {
     wl_list_remove(&eventListeners.outputCommit.link);
     wl_list_remove(&eventListeners.outputDamage.link);
     wl_list_remove(&eventListeners.outputNeedsFrame.link);
+    wl_list_remove(&eventListeners.outputPresent.link);
+
+    // 尚未显示的帧不会再显示了。销毁时会向客户端发送 discarded。
+
+    for (auto& it : presentationFeedbacks) {
+        wlr_presentation_feedback_destroy(it.feedback);
+    }
 
 }
 
@@ -692,7 +1047,9 @@ void Output::FramebufferPlate::recycle(wlr_buffer* oldBuf) {
 }
 
 
-wlr_buffer* Output::FramebufferPlate::get(pixman::Region32& damage) {
+wlr_buffer* Output::FramebufferPlate::get(
+    common::TileBitmap& damage, pixman::Region32* videoRegion
+) {
     // called by external threads
 
     lock.acquire();
@@ -705,15 +1062,20 @@ wlr_buffer* Output::FramebufferPlate::get(pixman::Region32& damage) {
 
         damage = buf.damage;
         buf.damage.clear();
+
+        if (videoRegion) {
+            *videoRegion = buf.videoRegion;
+        }
     }
     lock.release();
     return ret;
-}  // wlr_buffer* Output::FramebufferPlate::get(pixman::Region32& damage)
+}  // wlr_buffer* Output::FramebufferPlate::get
 
 
 void Output::FramebufferPlate::put(
     wlr_buffer* newBuf, 
     const pixman::Region32& damage,
+    const pixman::Region32& videoRegion,
     bool dontLockBuffer
 ) {
     // called by desktop server thread
@@ -735,7 +1097,16 @@ void Output::FramebufferPlate::put(
     if (!dontLockBuffer) {
         wlr_buffer_lock(newBuf);
     }
-    buf.damage += damage;
+
+    // 分辨率变化时，整个画面都要重新发送。
+
+    if (buf.damage.width() != newBuf->width || buf.damage.height() != newBuf->height) {
+        buf.damage.resize(newBuf->width, newBuf->height);
+        buf.damage.setAll();
+    }
+
+    buf.damage.addRegion(damage);
+    buf.videoRegion = videoRegion;
     lock.release();
 
     if (oldBuf) {  // now we can unref it without blocking other threads.
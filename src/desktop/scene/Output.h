@@ -11,6 +11,7 @@
 #include "../../utils/wlroots-cpp.h"
 
 #include "../../bindings/pixman.h"
+#include "../../common/TileBitmap.h"
 
 #include <vector>
 #include <semaphore>
@@ -32,6 +33,12 @@ public:
         bool alwaysRenderEntireScreen;
         bool exportScreenBuffer;
         bool forceRenderSoftwareCursor;
+        bool renderOnDemand;
+
+        /**
+         * 完全被遮挡的窗口每秒最多收到多少次 frame done。0 表示完全不发送。
+         */
+        int occludedFrameRate;
     };
 
     static Output* create(const CreateOptions&);
@@ -42,15 +49,56 @@ public:
 
     struct StateOptions {
         RenderTimer* timer;
+
+        /** 不为 0 时，随本帧一起把刷新率改为该值（mHz）。 */
+        int refreshMilliHz;
     };
 
     void scheduleFrame();
 
+    /**
+     * 设置是否有人在等待新画面。仅在 renderOnDemand 模式下有意义。
+     * 
+     * 当没有需求时，scheduleFrame 不会真正安排新帧，damage 会累积在 damage ring 里。
+     * 需求出现后，累积的 damage 会被一次性渲染。
+     * 
+     * 传入的是当前状态而不是增减，重复或丢失一次调用都不会让状态一直出错。
+     */
+    void demandFrames(bool demand);
+
     bool commit(StateOptions* options);
 
     bool buildState(wlr_output_state* state, StateOptions* options);
 
-    void sendFrameDone(timespec* now);
+    /**
+     * 向本输出上的窗口发送 frame done。
+     * 
+     * 完全被上层不透明内容遮挡的窗口不会收到，或按 occludedFrameRate 降频收到。
+     * 窗口重新露出后，下一帧即恢复正常。
+     * 
+     * @param occludedOnly 只处理被遮挡、正在降频的窗口。
+     */
+    void sendFrameDone(timespec* now, bool occludedOnly = false);
+
+    /**
+     * 取走窗口待发送的 presentation 反馈。反馈会在下一次提交的画面显示后发送。
+     */
+    void addPresentationFeedback(wlr_surface* surface);
+
+    /**
+     * 输出的画面已显示（或被丢弃）。发送对应提交的 presentation 反馈。
+     */
+    void presented(wlr_output_event_present* event);
+
+    /**
+     * 最近每秒带有 damage 的帧数。长时间没有 damage 时会随之衰减。
+     */
+    double damageRate(int64_t nowNsec) const;
+
+    /**
+     * 距离上一次带有 damage 的帧过去了多久（纳秒）。从未有过 damage 时返回 INT64_MAX。
+     */
+    int64_t damageIdleNsec(int64_t nowNsec) const;
 
 public:
     ~Output();
@@ -58,11 +106,24 @@ public:
 protected:
     int init(const CreateOptions&);
 
+    void recordDamagedFrame(int64_t nowNsec);
+
 public:
 
     bool alwaysRenderEntireScreen;
     bool exportScreenBuffer;
     bool forceRenderSoftwareCursor;
+    bool renderOnDemand;
+    int occludedFrameRate;
+
+    /** 为被遮挡窗口补发降频 frame done 的定时器。 */
+    wl_event_source* occludedFrameTimer = nullptr;
+
+    /** 是否有画面使用者正在等待新画面。 */
+    bool frameDemand = false;
+
+    /** 是否有因为没有需求而被搁置的帧。 */
+    bool frameDeferred = false;
 
     wlr_output* wlrOutput;
 
@@ -88,6 +149,7 @@ public:
         wl_listener outputCommit;
         wl_listener outputDamage;
         wl_listener outputNeedsFrame;
+        wl_listener outputPresent;
     } eventListeners;
 
     /** 屏幕（或虚拟屏幕）在所有屏幕组成的布局中的位置。 */
@@ -98,6 +160,38 @@ public:
 
     vesper::bindings::pixman::Region32 pendingCommitDamage;
 
+    struct PresentationFeedback {
+        wlr_presentation_feedback* feedback;
+
+        /** 是否已随某次提交送出。送出前 commitSeq 无意义。 */
+        bool committed;
+        uint32_t commitSeq;
+    };
+
+    std::vector<PresentationFeedback> presentationFeedbacks;
+
+    /**
+     * 显示序号。按两次显示之间经过的刷新周期数递增，保证单调。
+     */
+    uint64_t presentSeq = 0;
+    int64_t lastPresentNsec = 0;
+
+    struct {
+        int64_t lastFrameNsec = 0;
+
+        /** 带有 damage 的帧的频率，指数滑动平均。 */
+        double framesPerSec = 0;
+    } damageStats;
+
+    /**
+     * 上一次提交后的分辨率。
+     * 只有刷新率变化时，不需要重新计算整个场景。
+     */
+    struct {
+        int width = 0;
+        int height = 0;
+    } committedResolution;
+
     uint8_t index;
 
     struct RenderListEntry {
@@ -108,12 +202,22 @@ public:
 
     std::vector<RenderListEntry> renderList;
 
+    /**
+     * 上一帧中，声明为视频或游戏的窗口露出的区域（输出 buffer 坐标）。
+     */
+    vesper::bindings::pixman::Region32 videoRegion;
+
 
     struct FramebufferPlate {
     protected:
         struct {
             wlr_buffer* buf = nullptr;
-            vesper::bindings::pixman::Region32 damage;
+
+            /** 自上次被取走以来累积的 damage。 */
+            vesper::common::TileBitmap damage;
+
+            /** 该帧中视频或游戏内容所在的区域。 */
+            vesper::bindings::pixman::Region32 videoRegion;
         } buf;
 
         struct {
@@ -125,7 +229,14 @@ public:
     public:
         ~FramebufferPlate();
         void recycle(wlr_buffer*);
-        wlr_buffer* get(vesper::bindings::pixman::Region32& damage);
+        /**
+         * 
+         * @param videoRegion nullable. 用于取出最新一帧中视频内容所在的区域。
+         */
+        wlr_buffer* get(
+            vesper::common::TileBitmap& damage,
+            vesper::bindings::pixman::Region32* videoRegion = nullptr
+        );
 
         /**
          * 
@@ -135,6 +246,7 @@ public:
         void put(
             wlr_buffer*, 
             const vesper::bindings::pixman::Region32& damage,
+            const vesper::bindings::pixman::Region32& videoRegion,
             bool dontLockBuffer = false
         );
 
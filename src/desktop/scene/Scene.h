@@ -62,7 +62,11 @@ public:
      */
     wl_list outputs;
 
-    bool calculateVisibility;
+    /**
+     * 计算各节点被上层不透明内容遮挡后剩下的可见区域。
+     * 关闭时，每个节点的 visibleArea 就是它自身的范围。
+     */
+    bool calculateVisibility = true;
 
     /**
      * 
@@ -70,6 +74,12 @@ public:
      */
     wlr_linux_dmabuf_v1* linuxDmaBufV1 = nullptr;
 
+    /**
+     * 
+     * nullable
+     */
+    wlr_content_type_manager_v1* contentTypeManager = nullptr;
+
     struct {
         wl_listener linuxDmaBufV1Destroy;
     } eventListeners;
@@ -314,30 +314,6 @@ void SceneNode::opaqueRegion(int x, int y, pixman_region32_t* opaque) {
 }
 
 
-void SceneNode::sendFrameDone(Output* sceneOutput, timespec* now) {
-    if (!enabled) {
-        return;
-    }
-
-    if (type() == SceneNodeType::BUFFER) {
-
-        auto* p = (SceneBufferNode*) this;
-        if (p->primaryOutput == sceneOutput) {
-            if (p->visibleArea.notEmpty()) {
-                wl_signal_emit_mutable(&p->events.frameDone, now);
-            }
-        }
-
-    } else if (type() == SceneNodeType::TREE) {
-        auto* p = (SceneTreeNode*) this;
-        SceneNode* child;
-        wl_list_for_each(child, &p->children, link) {
-            child->sendFrameDone(sceneOutput, now);
-        }
-    }
-}
-
-
 void SceneNode::placeAbove(SceneNode* sibling) {
 
     if (link.prev == &sibling->link) {
@@ -605,6 +581,10 @@ void SceneBufferNode::updateNodeUpdateOutputs(
     Output* oldPrimaryOutput = this->primaryOutput;
     this->primaryOutput = nullptr;
 
+    if (this->lastPrimaryOutput == ignore) {
+        this->lastPrimaryOutput = nullptr;
+    }
+
     size_t count = 0;
     uint64_t activeOutputs = 0;
 
@@ -664,7 +644,10 @@ void SceneBufferNode::updateNodeUpdateOutputs(
         }
     }
 
-    
+    if (primaryOutput) {
+        this->lastPrimaryOutput = primaryOutput;
+    }
+
     // 如果没有需要更新的内容，就不必发出 update 信号。
 
     bool canSkip = oldActive == activeOutputs 
@@ -701,10 +684,34 @@ static void scaleOutputDamage(pixman_region32_t* damage, float scale) {
 }
 
 
+/**
+ * 判断节点现有的 texture 能否通过局部上传的方式沿用到新 buffer 上。
+ *
+ * client buffer 的 texture 由 wlroots 自行维护，不在此列。
+ * 尺寸变化时必须重建 texture。格式是否兼容由 wlr_texture_update_from_buffer 判断。
+ */
+static bool sceneBufferNodeTextureReusable(SceneBufferNode* buf, wlr_buffer* wlrBuffer) {
+    if (buf->texture == nullptr || wlrBuffer == nullptr) {
+        return false;
+    }
+
+    if (wlr_client_buffer_get(wlrBuffer)) {
+        return false;
+    }
+
+    return buf->texture->width == uint32_t(wlrBuffer->width)
+        && buf->texture->height == uint32_t(wlrBuffer->height);
+}
+
+
 void SceneBufferNode::setBuffer(wlr_buffer* wlrBuffer, pixman_region32_t* damage) {
     bool update = false;
-    wlr_texture_destroy(this->texture);
-    this->texture = nullptr;
+
+    bool reuseTexture = sceneBufferNodeTextureReusable(this, wlrBuffer);
+    if (!reuseTexture) {
+        wlr_texture_destroy(this->texture);
+        this->texture = nullptr;
+    }
 
     if (wlrBuffer) {
         update = dstHeight == 0 && dstWidth == 0 
@@ -715,9 +722,33 @@ void SceneBufferNode::setBuffer(wlr_buffer* wlrBuffer, pixman_region32_t* damage
 
     sceneBufferNodeSetBuffer(this, wlrBuffer);
 
+    pixman::Region32 fallbackDamage;
+    if (wlrBuffer) {
+        fallbackDamage = (const wlr_box) {
+            .x = 0, .y = 0, .width = wlrBuffer->width, .height = wlrBuffer->height
+        };
+    }
+
+    if (!damage) {
+        damage = fallbackDamage.raw();
+    }
+
+    if (reuseTexture) {
+        // 只上传 damage 覆盖的部分。失败时（如格式变化）退回到重建 texture 的路线。
+        if (wlr_texture_update_from_buffer(this->texture, wlrBuffer, damage)) {
+            if (this->ownBuffer) {
+                this->ownBuffer = false;
+                wlr_buffer_unlock(this->wlrBuffer);
+            }
+        } else {
+            wlr_texture_destroy(this->texture);
+            this->texture = nullptr;
+        }
+    }
+
     if (update) {
         this->update(nullptr);
-        return;    
+        return;
     }
 
     int lx, ly;
@@ -725,14 +756,6 @@ void SceneBufferNode::setBuffer(wlr_buffer* wlrBuffer, pixman_region32_t* damage
         return;
     }
 
-    pixman::Region32 fallbackDamage = (const wlr_box) {
-        .x = 0, .y = 0, .width = wlrBuffer->width, .height = wlrBuffer->height
-    };
-    
-    if (!damage) {
-        damage = fallbackDamage.raw();
-    }
-
     wlr_fbox box = srcBox;
     if (wlr_fbox_empty(&box)) {
         box.x = box.y = 0;
@@ -33,6 +33,13 @@ enum class SceneNodeType {
     TREE, BUFFER, RECT
 };
 
+/**
+ * 客户端通过 content-type-v1 声明的内容类型。
+ */
+enum class ContentType {
+    NONE, PHOTO, VIDEO, GAME
+};
+
 /**
  * 场景树节点基类。
  */
@@ -84,8 +91,6 @@ public:
 
     virtual bool invisible() = 0;
 
-    void sendFrameDone(Output* sceneOutput, timespec* now);
-
     void placeAbove(SceneNode* sibling);
     void placeBelow(SceneNode* sibling);
 
@@ -208,6 +213,17 @@ public:
 
     Output* primaryOutput = nullptr;
 
+    /**
+     * 最近一次不为空的 primaryOutput。
+     * 窗口被完全遮挡后 primaryOutput 变为空，仍按这个输出限制它的帧率。
+     */
+    Output* lastPrimaryOutput = nullptr;
+
+    ContentType contentType = ContentType::NONE;
+
+    /** 上一次发出 frame done 的时间（纳秒）。用于限制被遮挡窗口的帧率。 */
+    int64_t lastFrameDoneNsec = 0;
+
     float opacity = 0;
 
     wlr_fbox srcBox;
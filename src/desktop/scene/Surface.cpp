@@ -63,7 +63,7 @@ static void surfaceOutputSampleEventBridge (wl_listener* listener, void* data) {
         return;
     }
 
-    wlr_presentation_surface_textured_on_output(surface->wlrSurface, output->wlrOutput);
+    output->addPresentationFeedback(surface->wlrSurface);
 }
 
 
@@ -84,12 +84,34 @@ static void surfaceSurfaceDestroyEventBridge (wl_listener* listener, void* data)
 }
 
 
+static ContentType surfaceContentType(Surface* surface) {
+    Scene* scene = surface->buffer->getRootScene();
+    if (scene == nullptr || scene->contentTypeManager == nullptr) {
+        return ContentType::NONE;
+    }
+
+    auto type = wlr_surface_get_content_type_v1(scene->contentTypeManager, surface->wlrSurface);
+    switch (type) {
+        case WP_CONTENT_TYPE_V1_TYPE_PHOTO:
+            return ContentType::PHOTO;
+        case WP_CONTENT_TYPE_V1_TYPE_VIDEO:
+            return ContentType::VIDEO;
+        case WP_CONTENT_TYPE_V1_TYPE_GAME:
+            return ContentType::GAME;
+        default:
+            return ContentType::NONE;
+    }
+}
+
+
 static void surfaceSurfaceCommitEventBridge (wl_listener* listener, void* data) {
     Surface* surface = wl_container_of(listener, surface, eventListeners.surfaceCommit);
     
     SceneBufferNode* sceneBuffer = surface->buffer;
     surface->reconfigure();
 
+    sceneBuffer->contentType = surfaceContentType(surface);
+
     int lx, ly;
     bool enabled = sceneBuffer->coords(&lx, &ly);
 
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 帧调度
+ *
+ * 创建于 2026年10月18日
+ */
+
+#include "./FrameScheduler.h"
+
+using namespace std;
+
+namespace vesper::desktop::server {
+
+
+static inline int64_t timespecToNsec(const timespec* a) {
+    return ((int64_t) a->tv_sec) * 1000000000 + a->tv_nsec;
+}
+
+
+void FrameScheduler::addSample(int64_t preRenderNsec, int64_t renderNsec) {
+    if (preRenderNsec < 0) {
+        preRenderNsec = 0;
+    }
+
+    if (renderNsec < 0) {
+        renderNsec = 0;
+    }
+
+    samples[nextSample] = preRenderNsec + renderNsec;
+    nextSample = (nextSample + 1) % SAMPLE_COUNT;
+
+    if (sampleCount < SAMPLE_COUNT) {
+        sampleCount++;
+    }
+}
+
+
+void FrameScheduler::presented(const timespec* when) {
+    if (when) {
+        lastPresentNsec = timespecToNsec(when);
+    }
+}
+
+
+int FrameScheduler::msecUntilRender(int64_t refreshNsec) {
+    if (refreshNsec <= 0 || sampleCount == 0 || lastPresentNsec == 0) {
+        return 0;
+    }
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t nowNsec = timespecToNsec(&now);
+
+    // 预测下一次刷新发生的时间。
+
+    int64_t nextRefreshNsec = lastPresentNsec + refreshNsec;
+    if (nextRefreshNsec <= nowNsec) {
+        int64_t missed = (nowNsec - nextRefreshNsec) / refreshNsec + 1;
+        nextRefreshNsec += missed * refreshNsec;
+    }
+
+    // 用最近几帧中最慢的那一帧来估计本帧耗时。偏保守，但不容易错过刷新。
+
+    int64_t budgetNsec = 0;
+    for (int i = 0; i < sampleCount; i++) {
+        if (samples[i] > budgetNsec) {
+            budgetNsec = samples[i];
+        }
+    }
+
+    budgetNsec += safetyMarginNsec;
+
+    int64_t delayNsec = nextRefreshNsec - nowNsec - budgetNsec;
+    if (delayNsec < 1000000) {
+        return 0;
+    }
+
+    return int(delayNsec / 1000000);
+}
+
+
+void FrameScheduler::reset() {
+    sampleCount = 0;
+    nextSample = 0;
+    lastPresentNsec = 0;
+}
+
+
+} // namespace vesper::desktop::server
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 帧调度
+ *
+ * 创建于 2026年10月18日
+ *
+ * 根据 RenderTimer 测得的渲染耗时，推迟合成时机，让合成尽量贴近下一次刷新的截止时间。
+ * 这样，在两次刷新之间到达的客户端提交可以合并进同一帧。
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+
+namespace vesper::desktop::server {
+
+class FrameScheduler {
+
+public:
+
+    /**
+     * 记录一帧的耗时。
+     *
+     * @param preRenderNsec 渲染前准备工作的耗时（纳秒）。
+     * @param renderNsec 渲染本身的耗时（纳秒）。未知时传入负数。
+     */
+    void addSample(int64_t preRenderNsec, int64_t renderNsec);
+
+    /**
+     * 记录屏幕实际完成显示的时间。
+     */
+    void presented(const timespec* when);
+
+    /**
+     * 计算距离开始合成下一帧还应等待多久。
+     *
+     * @param refreshNsec 屏幕刷新周期（纳秒）。不大于 0 表示未知。
+     *
+     * @return 应等待的毫秒数。0 表示应立即合成。
+     */
+    int msecUntilRender(int64_t refreshNsec);
+
+    void reset();
+
+public:
+
+    /** 在预测的渲染耗时之外，额外预留的时间（纳秒）。 */
+    int64_t safetyMarginNsec = 1000000;
+
+protected:
+
+    static const int SAMPLE_COUNT = 16;
+
+    /** 最近若干帧的耗时（纳秒）。以环形数组形式存放。 */
+    int64_t samples[SAMPLE_COUNT] = {0};
+    int sampleCount = 0;
+    int nextSample = 0;
+
+    int64_t lastPresentNsec = 0;
+
+};
+
+} // namespace vesper::desktop::server
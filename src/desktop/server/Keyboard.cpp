@@ -117,6 +117,10 @@ int Keyboard::init(const CreateOptions& options) {
     wlr_keyboard_set_keymap(wlrKeyboard, xkbKeymap);
     wlr_keyboard_set_repeat_info(wlrKeyboard, 25, 600);
 
+    // 远程输入的 keysym 按实际使用的布局反查按键。
+
+    xKeysymUseKeymap(xkbKeymap);
+
     xkb_keymap_unref(xkbKeymap);
     xkb_context_unref(xkbContext);
 
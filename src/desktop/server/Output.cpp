@@ -29,6 +29,22 @@ static void frameEventBridge(wl_listener* listener, void* data) {
 }
 
 
+static void presentEventBridge(wl_listener* listener, void* data) {
+
+    Output* output = wl_container_of(listener, output, eventListeners.present);
+
+    output->presentEventHandler((wlr_output_event_present*) data);
+}
+
+
+static int repaintTimerBridge(void* data) {
+    
+    auto* output = (Output*) data;
+    output->repaint();
+    return 0;
+}
+
+
 static void requestStateEventBridge(wl_listener* listener, void* data) {
 
     Output* output = wl_container_of(listener, output, eventListeners.requestState);
@@ -42,6 +58,7 @@ static void destroyEventBridge(wl_listener* listener, void* data) {
     
     wl_list_remove(&output->eventListeners.destroy.link);
     wl_list_remove(&output->eventListeners.requestState.link);
+    wl_list_remove(&output->eventListeners.present.link);
     wl_list_remove(&output->eventListeners.frame.link);
     wl_list_remove(&output->link);
 
@@ -62,6 +79,9 @@ int Output::init(const CreateOptions& options) {
     eventListeners.frame.notify = frameEventBridge;
     wl_signal_add(&wlrOutput->events.frame, &eventListeners.frame);
 
+    eventListeners.present.notify = presentEventBridge;
+    wl_signal_add(&wlrOutput->events.present, &eventListeners.present);
+
     eventListeners.requestState.notify = requestStateEventBridge;
     wl_signal_add(&wlrOutput->events.request_state, &eventListeners.requestState);
 
@@ -70,6 +90,15 @@ int Output::init(const CreateOptions& options) {
 
     wl_list_insert(&server->outputs, &link);
 
+    repaintTimer = wl_event_loop_add_timer(server->wlEventLoop, repaintTimerBridge, this);
+
+    auto& adaptiveRefreshOptions = server->options.output.adaptiveRefresh;
+    adaptiveRefresh = adaptiveRefreshOptions.enabled && wlr_output_is_headless(wlrOutput);
+    if (adaptiveRefresh) {
+        refreshGovernor.minMilliHz = adaptiveRefreshOptions.minMilliHz;
+        refreshGovernor.maxMilliHz = adaptiveRefreshOptions.maxMilliHz;
+    }
+
     wlr_output_layout_output* layoutOutput = wlr_output_layout_add_auto(
         server->wlrOutputLayout, wlrOutput
     );
@@ -82,6 +111,8 @@ int Output::init(const CreateOptions& options) {
         .alwaysRenderEntireScreen = outputOptions.alwaysRenderEntireScreen,
         .exportScreenBuffer = outputOptions.exportScreenBuffer,
         .forceRenderSoftwareCursor = outputOptions.forceRenderSoftwareCursor,
+        .renderOnDemand = outputOptions.renderOnDemand,
+        .occludedFrameRate = outputOptions.occludedFrameRate,
     });
     
     if (sceneOutput == nullptr) {
@@ -97,12 +128,100 @@ int Output::init(const CreateOptions& options) {
 }
 
 
+Output::~Output() {
+    if (repaintTimer) {
+        wl_event_source_remove(repaintTimer);
+        repaintTimer = nullptr;
+    }
+
+    if (renderTimer.wlrRenderTimer) {
+        wlr_render_timer_destroy(renderTimer.wlrRenderTimer);
+        renderTimer.wlrRenderTimer = nullptr;
+    }
+}
+
+
 void Output::frameEventHandler() {
+    if (repaintScheduled) {
+        return;  // 已经安排好了合成时机。
+    }
+
+    // headless 输出的刷新周期从提交时刻开始计算，推迟提交只会拉低帧率。
+
+    int delayMsec = 0;
+    if (repaintTimer && !wlr_output_is_headless(wlrOutput) && wlrOutput->refresh > 0) {
+        int64_t refreshNsec = 1000000000000ll / wlrOutput->refresh;
+        delayMsec = frameScheduler.msecUntilRender(refreshNsec);
+    }
+
+    if (delayMsec > 0) {
+        repaintScheduled = true;
+        wl_event_source_timer_update(repaintTimer, delayMsec);
+    } else {
+        this->repaint();
+    }
+}
+
+
+void Output::presentEventHandler(wlr_output_event_present* event) {
+    if (event->presented) {
+        frameScheduler.presented(event->when);
+    }
+}
+
+
+void Output::repaint() {
+    repaintScheduled = false;
+
     scene::Scene* scene = server->scene;
 
     scene::Output* sceneOutput = scene->getSceneOutput(this->wlrOutput);
 
-    sceneOutput->commit(nullptr);
+    // 上一帧的耗时此时已经可以读取。
+
+    if (renderTimer.wlrRenderTimer || renderTimer.preRenderDuration > 0) {
+        int64_t renderNsec = -1;  // 部分 renderer 不支持计时。
+
+        if (renderTimer.wlrRenderTimer) {
+            renderNsec = wlr_render_timer_get_duration_ns(renderTimer.wlrRenderTimer);
+            wlr_render_timer_destroy(renderTimer.wlrRenderTimer);
+        }
+
+        frameScheduler.addSample(renderTimer.preRenderDuration, renderNsec);
+
+        renderTimer = {
+            .preRenderDuration = 0,
+            .wlrRenderTimer = nullptr
+        };
+    }
+
+    scene::Output::StateOptions stateOptions = {
+        .timer = &renderTimer,
+        .refreshMilliHz = 0
+    };
+
+    // 新的刷新率随本帧一起提交，不单独提交模式。
+
+    if (adaptiveRefresh) {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t nowNsec = int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+
+        stateOptions.refreshMilliHz = refreshGovernor.update(
+            wlrOutput->refresh, 
+            sceneOutput->damageRate(nowNsec), 
+            sceneOutput->damageIdleNsec(nowNsec),
+            nowNsec
+        );
+
+        // 屏幕上有视频或游戏时，保持最高刷新率。
+
+        if (sceneOutput->videoRegion.notEmpty()) {
+            stateOptions.refreshMilliHz = refreshGovernor.maxMilliHz;
+        }
+    }
+
+    sceneOutput->commit(&stateOptions);
     
     timespec now;
     clock_gettime(CLOCK_MONOTONIC, &now);
@@ -10,6 +10,9 @@
 
 #include "../../utils/wlroots-cpp.h"
 #include "../../utils/ObjUtils.h"
+#include "../scene/RenderTimer.h"
+#include "./FrameScheduler.h"
+#include "./RefreshRateGovernor.h"
 
 namespace vesper::desktop::scene { class Output; }
 
@@ -34,6 +37,14 @@ public:
     static Output* create(const CreateOptions&);
 
     void frameEventHandler();
+    void presentEventHandler(wlr_output_event_present* event);
+
+    /**
+     * 合成并提交一帧，然后向客户端发送 frame done。
+     */
+    void repaint();
+
+    ~Output();
 
 protected:
     Output() {};
@@ -47,8 +58,22 @@ public:
     wlr_output* wlrOutput;
     vesper::desktop::scene::Output* sceneOutput;
 
+    vesper::desktop::scene::RenderTimer renderTimer = {0};
+    FrameScheduler frameScheduler;
+
+    /** 是否根据画面变化频率自动调整刷新率。仅对虚拟屏幕生效。 */
+    bool adaptiveRefresh = false;
+    RefreshRateGovernor refreshGovernor;
+
+    /**
+     * 推迟合成时使用的定时器。
+     */
+    wl_event_source* repaintTimer = nullptr;
+    bool repaintScheduled = false;
+
     struct {
         wl_listener frame; // 输出一帧
+        wl_listener present;
         wl_listener requestState;
         wl_listener destroy;
     } eventListeners;
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 刷新率调节
+ *
+ * 创建于 2026年10月18日
+ */
+
+#include "./RefreshRateGovernor.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace vesper::desktop::server {
+
+
+int RefreshRateGovernor::update(
+    int currentMilliHz, double damageFps, int64_t idleNsec, int64_t nowNsec
+) {
+    if (currentMilliHz <= 0) {
+        currentMilliHz = maxMilliHz;
+    }
+
+    // 画面持续变化：每次翻倍，尽快升到上限。
+
+    if (damageFps * 1000 >= currentMilliHz * continuousRatio) {
+        belowSinceNsec = 0;
+        return clamp(currentMilliHz * 2, minMilliHz, maxMilliHz);
+    }
+
+    // 画面变化较少：目标刷新率留出余量，并取整到 1 Hz。
+
+    int targetMilliHz = int(damageFps * headroom) * 1000;
+    targetMilliHz = clamp(targetMilliHz, minMilliHz, maxMilliHz);
+
+    if (targetMilliHz >= currentMilliHz) {
+        belowSinceNsec = 0;
+        return currentMilliHz;
+    }
+
+    // 降低刷新率需要 damage 频率持续偏低一段时间，避免来回跳动。
+    // 如果已经空闲了足够久，就不用再等。
+
+    if (idleNsec < lowerHoldNsec) {
+        if (belowSinceNsec == 0) {
+            belowSinceNsec = nowNsec;
+        }
+
+        if (nowNsec - belowSinceNsec < lowerHoldNsec) {
+            return currentMilliHz;
+        }
+    }
+
+    belowSinceNsec = 0;
+    return targetMilliHz;
+}
+
+
+} // namespace vesper::desktop::server
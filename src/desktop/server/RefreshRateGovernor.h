@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 刷新率调节
+ *
+ * 创建于 2026年10月18日
+ *
+ * 为虚拟屏幕选择刷新率：画面几乎不变时降到最低刷新率，
+ * 画面持续变化（视频、拖动窗口等）时逐步提升到最高刷新率。
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace vesper::desktop::server {
+
+class RefreshRateGovernor {
+
+public:
+
+    /**
+     * 根据最近的 damage 频率，给出下一帧应使用的刷新率。
+     *
+     * @param currentMilliHz 当前刷新率（mHz）。不大于 0 表示未知。
+     * @param damageFps 最近每秒带有 damage 的帧数。
+     * @param idleNsec 距离上一次出现 damage 已经过去多久（纳秒）。
+     * @param nowNsec 当前时间（纳秒，CLOCK_MONOTONIC）。
+     *
+     * @return 建议的刷新率（mHz）。
+     */
+    int update(int currentMilliHz, double damageFps, int64_t idleNsec, int64_t nowNsec);
+
+public:
+
+    /** 刷新率下限（mHz）。 */
+    int minMilliHz = 10000;
+
+    /** 刷新率上限（mHz）。 */
+    int maxMilliHz = 60000;
+
+    /** damage 频率达到当前刷新率的这个比例时，认为画面在持续变化。 */
+    double continuousRatio = 0.75;
+
+    /** 降低刷新率时，保留的余量倍数。 */
+    double headroom = 2.0;
+
+    /** damage 频率需要持续偏低这么久，才会降低刷新率（纳秒）。 */
+    int64_t lowerHoldNsec = 1000000000;
+
+protected:
+
+    /** damage 频率从何时开始持续偏低。0 表示没有偏低。 */
+    int64_t belowSinceNsec = 0;
+
+};
+
+} // namespace vesper::desktop::server
@@ -27,8 +27,11 @@
 #include <signal.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/eventfd.h>
 
 #include <thread>
+#include <algorithm>
+#include <cstring>
 
 #include <linux/input-event-codes.h>
 
@@ -163,6 +166,12 @@ static void requestSetSelectionEventBridge(wl_listener* listener, void* data) {
 
 Server::~Server() {
     
+    // 其他线程可能仍在放入指令，eventFd 保留到最后。
+
+    if (runtimeControlCmds.eventFd >= 0) {
+        close(runtimeControlCmds.eventFd);
+        runtimeControlCmds.eventFd = -1;
+    }
 }
 
 static void clearRunOptionsResult(Server::RunOptions& options) {
@@ -233,6 +242,24 @@ int Server::run() {
     wlr_subcompositor_create(wlDisplay);
     wlr_data_device_manager_create(wlDisplay);
 
+    // 让客户端能够拿到画面实际显示的时间，以此安排自己的绘制节奏。
+
+    wlrPresentation = wlr_presentation_create(wlDisplay, wlrBackend);
+    if (!wlrPresentation) {
+        LOG_WARN("failed to create wp_presentation. clients will pace on frame done only.");
+    }
+
+    // 客户端可以提交缩小的 buffer 再由合成器缩放，或用单像素 buffer 画纯色区域。
+    // 缩放和裁剪由 Surface::reconfigure 按 wlr_surface 的 viewport 状态处理。
+
+    if (!wlr_viewporter_create(wlDisplay)) {
+        LOG_WARN("failed to create wp_viewporter.");
+    }
+
+    if (!wlr_single_pixel_buffer_manager_v1_create(wlDisplay)) {
+        LOG_WARN("failed to create wp_single_pixel_buffer_manager_v1.");
+    }
+
     wlrOutputLayout = wlr_output_layout_create(wlDisplay);
 
     wl_list_init(&outputs);
@@ -256,6 +283,13 @@ int Server::run() {
         return -1;
     }
 
+    // 客户端声明的内容类型（视频、游戏等）会影响编码质量和刷新率。
+
+    scene->contentTypeManager = wlr_content_type_manager_v1_create(wlDisplay, 1);
+    if (!scene->contentTypeManager) {
+        LOG_WARN("failed to create wp_content_type_manager_v1.");
+    }
+
     // xdg shell
     
     wl_list_init(&views);
@@ -320,6 +354,14 @@ int Server::run() {
     setenv("XDG_SESSION_TYPE", "wayland", true);
     setenv("XDG_SESSION_DESKTOP", "Vesper", true);
 
+    if (options.runtimeCtrl.enabled && this->initRuntimeControl() != 0) {
+        wlr_backend_destroy(wlrBackend);
+        wl_display_destroy(wlDisplay);
+        this->wlDisplay = nullptr;
+        options.result.code = -1;
+        return -1;
+    }
+
     // launch apps
 
     for (auto& it : options.launch.apps) {
@@ -349,9 +391,6 @@ int Server::run() {
     // wayland event loop
 
     options.result.signals.serverLaunched.release();
-    if (options.runtimeCtrl.enabled) {
-        this->runtimeControlEventLoop();  // run async
-    }
 
     this->wlDisplayRunning = true;
     wl_display_run(wlDisplay); // run blocking.
@@ -372,9 +411,9 @@ void Server::terminate() {
 
     terminated = true;
 
-    if (this->runtimeControlTimer) {
-        wl_event_source_remove(this->runtimeControlTimer);
-        this->runtimeControlTimer = nullptr;
+    if (this->runtimeControlEventSource) {
+        wl_event_source_remove(this->runtimeControlEventSource);
+        this->runtimeControlEventSource = nullptr;
     }
 
     wl_event_loop_add_idle(
@@ -445,54 +484,80 @@ void Server::clear() {
 }
 
 
-void Server::runtimeControlEventLoop() {
-    if (this->terminated) {
-        return;
+int Server::initRuntimeControl() {
+    auto& cmds = runtimeControlCmds;
+
+    if (cmds.eventFd < 0) {
+        cmds.eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (cmds.eventFd < 0) {
+            LOG_ERROR("failed to create eventfd for runtime control!");
+            return -1;
+        }
     }
 
-    
-    // do things
+    this->runtimeControlEventSource = wl_event_loop_add_fd(
+        this->wlEventLoop, cmds.eventFd, WL_EVENT_READABLE,
+        [] (int fd, uint32_t mask, void* data) {
+            uint64_t count;
+            while (read(fd, &count, sizeof(count)) > 0) {}
+            
+            ((Server*) data)->processRuntimeControlCmds();
+            return 0;
+        },
+        this
+    );
 
-    if (this->runtimeControlTimer) {
-        wl_event_source_remove(this->runtimeControlTimer);
+    if (this->runtimeControlEventSource == nullptr) {
+        LOG_ERROR("failed to watch eventfd for runtime control!");
+        return -1;
     }
 
+    // 启动前放入的指令，在事件循环开始后立即处理。
 
-    if (this->wlDisplayRunning) {
-        runtimeControlCmds.lock.acquire();
+    uint64_t one = 1;
+    if (write(cmds.eventFd, &one, sizeof(one)) < 0) {
+        LOG_WARN("failed to wake up runtime control.");
+    }
 
-        while (!runtimeControlCmds.waitingQueue.empty()) {
-            auto& it = runtimeControlCmds.waitingQueue.front();
-            it.f(this, it.data);  // invokes
-            if (it.data) {
-                delete it.data;
-            }
-            runtimeControlCmds.waitingQueue.pop();
-        }
+    return 0;
+}
 
-        runtimeControlCmds.lock.release();
-    } // if (this->wlDisplayRunning)
 
+void Server::processRuntimeControlCmds() {
 
-    // register next loop
+    // 先清除标记再取指令。此后放入的指令会再写一次 eventFd，不会被遗漏。
 
-    if (!this->terminated) {
-        this->runtimeControlTimer = wl_event_loop_add_timer(
-            this->wlEventLoop,
-            [] (void* data) { 
-                ((Server*) data)->runtimeControlEventLoop();
-                return 0;
-            },
-            this
-        );
+    auto& cmds = runtimeControlCmds;
 
-        wl_event_source_timer_update(runtimeControlTimer, options.runtimeCtrl.checkIntervalMs);
-        
+    cmds.wakeupPending.exchange(false, memory_order_acq_rel);
+
+    while (cmds.queue.pop([this] (RuntimeControlCmd& cmd) {
+        cmd.f(this, cmd.data);  // invokes
+    })) {}
+
+    // 队列满后放入 overflow 的指令，都晚于队列里的指令。
+    // 队列里还有没写完的指令时先不处理 overflow。写完的生产者会再次唤醒。
+
+    if (!cmds.overflowed.load(memory_order_acquire) || !cmds.queue.empty()) {
+        return;
+    }
+
+    vector<RuntimeControlCmd> overflow;
+    {
+        lock_guard lock(cmds.overflowMutex);
+        overflow.swap(cmds.overflow);
+        cmds.overflowed.store(false, memory_order_release);
+    }
+
+    for (auto& cmd : overflow) {
+        cmd.f(this, cmd.data);  // invokes
     }
 }
 
 
-void* Server::getFramebuffer(int displayIndex, pixman::Region32& damage) {
+void* Server::getFramebuffer(
+    int displayIndex, common::TileBitmap& damage, pixman::Region32* videoRegion
+) {
     if (this->terminated) {
         return nullptr;
     }
@@ -516,7 +581,7 @@ void* Server::getFramebuffer(int displayIndex, pixman::Region32& damage) {
 
     auto& plate = serverOutput->sceneOutput->framebufferPlate;
 
-    wlr_buffer* wlrBuf = plate.get(damage);
+    wlr_buffer* wlrBuf = plate.get(damage, videoRegion);
     if (!wlrBuf) {
         return nullptr;
     }
@@ -640,13 +705,50 @@ static inline int64_t currTimeMsec() {
 }
 
 
+template<typename Args>
+bool Server::addRuntimeControlCmd(void (*f)(Server*, void* data), const Args& args, bool droppable) {
+    static_assert(is_trivially_copyable_v<Args>);
+    static_assert(sizeof(Args) <= RuntimeControlCmd::MAX_DATA_SIZE);
+    static_assert(alignof(Args) <= alignof(RuntimeControlCmd));
+
+    auto& cmds = runtimeControlCmds;
+
+    auto fill = [&] (RuntimeControlCmd& cmd) {
+        cmd.f = f;
+        memcpy(cmd.data, &args, sizeof(Args));
+    };
+
+    bool added = !cmds.overflowed.load(memory_order_acquire) && cmds.queue.push(fill);
+
+    if (!added) {
+        if (droppable) {
+            return false;
+        }
+
+        lock_guard lock(cmds.overflowMutex);
+        fill(cmds.overflow.emplace_back());
+        cmds.overflowed.store(true, memory_order_release);
+    }
+
+    if (!cmds.wakeupPending.exchange(true, memory_order_acq_rel)) {
+        uint64_t one = 1;
+        if (write(cmds.eventFd, &one, sizeof(one)) < 0) {
+            LOG_WARN("failed to wake up runtime control.");
+        }
+    }
+
+    return true;
+}
+
+
 #define ADD_CMD_TO_QUEUE(callable) \
-    runtimeControlCmds.lock.acquire(); \
-    runtimeControlCmds.waitingQueue.emplace((RuntimeControlCmd) { \
-        .f = callable, \
-        .data = args \
-    }); \
-    runtimeControlCmds.lock.release(); 
+    addRuntimeControlCmd(callable, args);
+
+#define ADD_DROPPABLE_CMD_TO_QUEUE(callable) \
+    if (!addRuntimeControlCmd(callable, args, true)) { \
+        LOG_WARN("runtime control queue is full. command dropped."); \
+        return -1; \
+    }
 
 
 int Server::setResolutionAsync(int index, int width, int height, int refreshRate) {
@@ -654,16 +756,11 @@ int Server::setResolutionAsync(int index, int width, int height, int refreshRate
         return -1;
     }
 
-    auto* args = new (nothrow) SetResolutionAsyncArgs;
-    if (!args) {
-        LOG_ERROR("failed to alloc command for SetResolutionAsyncArgs!")
-        return -1;
-    }
-
-    args->index = index;
-    args->width = width;
-    args->height = height;
-    args->refreshRate = refreshRate;
+    SetResolutionAsyncArgs args;
+    args.index = index;
+    args.width = width;
+    args.height = height;
+    args.refreshRate = refreshRate;
 
     ADD_CMD_TO_QUEUE(
         [] (Server* server, void* untypedData) {
@@ -674,6 +771,16 @@ int Server::setResolutionAsync(int index, int width, int height, int refreshRate
             Output* output;
             wl_list_for_each(output, &server->outputs, link) {
                 if (data->index == currIdx++) {
+
+                    // 自适应刷新率开启时，指定的刷新率作为上限。
+
+                    if (output->adaptiveRefresh && data->refreshRate > 0) {
+                        output->refreshGovernor.maxMilliHz = data->refreshRate;
+                        output->refreshGovernor.minMilliHz = min(
+                            output->refreshGovernor.minMilliHz, data->refreshRate
+                        );
+                    }
+
                     wlr_output_state state;
                     wlr_output_state_init(&state);
                     wlr_output_state_set_custom_mode(&state, data->width, data->height, data->refreshRate);
@@ -700,37 +807,38 @@ int Server::moveCursorAsync(
         return -1;
     }
 
-    auto* args = new (nothrow) MoveCursorAsyncArgs;
-    if (!args) {
-        LOG_ERROR("failed to alloc command for MoveCursorAsyncArgs!")
-        return -1;
-    }
-    args->absolute = absoulute;
-    args->absoluteX = absoluteX;
-    args->absoluteY = absoluteY;
-    args->delta = delta;
-    args->deltaX = deltaX;
-    args->deltaY = deltaY;
+    MoveCursorAsyncArgs args;
+    args.absolute = absoulute;
+    args.absoluteX = absoluteX;
+    args.absoluteY = absoluteY;
+    args.delta = delta;
+    args.deltaX = deltaX;
+    args.deltaY = deltaY;
 
+    auto moveCursor = [] (Server* server, void* untypedData) {
+        auto& cursor = server->cursor;
+        auto* data = (MoveCursorAsyncArgs*) untypedData;
+        auto& args = *data;
 
-    ADD_CMD_TO_QUEUE(
-        [] (Server* server, void* untypedData) {
-            auto& cursor = server->cursor;
-            auto* data = (MoveCursorAsyncArgs*) untypedData;
-            auto& args = *data;
+        auto currTime = currTimeMsec();
 
-            auto currTime = currTimeMsec();
+        wlr_cursor_warp_absolute(cursor->wlrCursor, nullptr, args.absoluteX, args.absoluteY);
+        wlr_cursor_move(cursor->wlrCursor, nullptr, args.deltaX, args.deltaY);
+        
+        cursor->processMotion(currTime);
 
-            wlr_cursor_warp_absolute(cursor->wlrCursor, nullptr, args.absoluteX, args.absoluteY);
-            wlr_cursor_move(cursor->wlrCursor, nullptr, args.deltaX, args.deltaY);
-            
-            cursor->processMotion(currTime);
+        wlr_seat_pointer_notify_frame(server->wlrSeat);
 
-            wlr_seat_pointer_notify_frame(server->wlrSeat);
+        Output* output = wl_container_of(server->outputs.next, output, link);
+    };
 
-            Output* output = wl_container_of(server->outputs.next, output, link);
-        }
-    )
+    // 绝对移动会被后续的移动覆盖，队列满时可以丢弃；
+    // 相对移动携带位移量，丢弃会丢失位移，必须入队。
+    if (absoulute && !delta) {
+        ADD_DROPPABLE_CMD_TO_QUEUE(moveCursor)
+    } else {
+        ADD_CMD_TO_QUEUE(moveCursor)
+    }
 
     return 0;
 }
@@ -743,13 +851,9 @@ int Server::pressMouseButtonAsync(bool press, vesper::common::MouseButton button
         return -1;
     }
 
-    auto* args = new (nothrow) PressMouseButtonAsyncArgs;
-    if (!args) {
-        LOG_ERROR("failed to alloc command for MoveCursorAsyncArgs!")
-        return -1;
-    }
-    args->press = press;
-    args->button = button;
+    PressMouseButtonAsyncArgs args;
+    args.press = press;
+    args.button = button;
 
     ADD_CMD_TO_QUEUE(
         [] (Server* server, void* untypedData) {
@@ -787,15 +891,10 @@ int Server::scrollAsync(bool vertical, double delta, int32_t deltaDiscrete) {
     if (!options.runtimeCtrl.enabled) {
         return -1;
     }
-    auto args = new (nothrow) ScrollAsyncArgs;
-    if (!args) {
-        LOG_ERROR("failed to alloc args for scrollAsync!")
-        return -1;
-    }
-
-    args->vertical = vertical;
-    args->delta = delta;
-    args->deltaDiscrete = deltaDiscrete;
+    ScrollAsyncArgs args;
+    args.vertical = vertical;
+    args.delta = delta;
+    args.deltaDiscrete = deltaDiscrete;
 
     ADD_CMD_TO_QUEUE(
         [] (Server* server, void* data) {
@@ -820,14 +919,9 @@ int Server::keyboardInputAsync(xkb_keysym_t keysym, bool pressed) {
     if (!options.runtimeCtrl.enabled) { 
         return -1; 
     }
-    auto args = new (nothrow) KeyboardInputAsyncArgs;
-    if (!args) {
-        LOG_ERROR("failed to alloc args for KeyboardInputAsync!")
-        return -1;
-    }
-
-    args->keysym = keysym;
-    args->pressed = pressed;
+    KeyboardInputAsyncArgs args;
+    args.keysym = keysym;
+    args.pressed = pressed;
 
     const auto handler = [] (Server* server, void* untypedData) {
         auto& args = * (KeyboardInputAsyncArgs*) untypedData;
@@ -895,12 +989,79 @@ int Server::keyboardInputAsync(xkb_keysym_t keysym, bool pressed) {
 }
 
 
+int Server::keyboardScancodeInputAsync(uint32_t scancode, bool pressed) {
+    if (!options.runtimeCtrl.enabled) { 
+        return -1; 
+    }
+    KeyboardScancodeInputAsyncArgs args;
+    args.scancode = scancode;
+    args.pressed = pressed;
+
+    const auto handler = [] (Server* server, void* untypedData) {
+        auto& args = * (KeyboardScancodeInputAsyncArgs*) untypedData;
+
+        wl_keyboard_key_state pressState = WL_KEYBOARD_KEY_STATE_RELEASED;
+        if (args.pressed) {
+            pressState = WL_KEYBOARD_KEY_STATE_PRESSED;
+        }
+
+        // 交给 xkb 更新修饰键状态，不必再逐个读出、改写。
+
+        wlr_keyboard_key_event event {
+            .time_msec = uint32_t(currTimeMsec()),
+            .keycode = args.scancode,
+            .update_state = true,
+            .state = pressState,
+        };
+
+        // 只考虑第一个键盘。
+        Keyboard* keyboard = wl_container_of(server->keyboards.next, keyboard, link);
+
+        wlr_keyboard_notify_key(keyboard->wlrKeyboard, &event);
+    };
+
+    ADD_CMD_TO_QUEUE(handler);
+
+
+    return 0;
+}
+
+
+int Server::setFramebufferDemandAsync(int displayIndex, bool demand) {
+    if (!options.runtimeCtrl.enabled) {
+        return -1;
+    }
+
+    SetFramebufferDemandAsyncArgs args;
+    args.displayIndex = displayIndex;
+    args.demand = demand;
+
+    ADD_CMD_TO_QUEUE(
+        [] (Server* server, void* untypedData) {
+            auto& args = * (SetFramebufferDemandAsyncArgs*) untypedData;
+
+            int currIdx = 0;
+
+            Output* output;
+            wl_list_for_each(output, &server->outputs, link) {
+                if (args.displayIndex == currIdx++) {
+                    output->sceneOutput->demandFrames(args.demand);
+                    break;
+                }
+            }
+        }
+    )
+
+    return 0;
+}
+
+
 int Server::terminateAsync() {
     if (!options.runtimeCtrl.enabled) {
         return -1;
     }
 
-    RuntimeCtrlAsyncArgsBase* args = nullptr;
+    RuntimeCtrlAsyncArgsBase args;
     ADD_CMD_TO_QUEUE(
         [] (Server* server, void*) {
             server->terminate();
@@ -912,6 +1073,7 @@ int Server::terminateAsync() {
 
 
 #undef ADD_CMD_TO_QUEUE
+#undef ADD_DROPPABLE_CMD_TO_QUEUE
 
 /* ============ 运行时，外部传入控制信息 结束 ============ */
 
@@ -11,7 +11,9 @@
 #include "../../utils/wlroots-cpp.h"
 #include "../../utils/ObjUtils.h"
 #include "../../common/MouseButton.h"
+#include "../../common/TileBitmap.h"
 #include "../../bindings/pixman.h"
+#include "../../common/MpscRing.h"
 #include "./Output.h"
 
 #include <unistd.h>
@@ -19,7 +21,8 @@
 #include <vector>
 #include <semaphore>
 #include <map>
-#include <queue>
+#include <atomic>
+#include <mutex>
 #include <functional>
 #include <sys/types.h>
 
@@ -95,11 +98,30 @@ public:
             bool exportScreenBuffer;
 
             bool forceRenderSoftwareCursor;
+
+            /**
+             * 仅在画面使用者（如 VNC 客户端）有未完成的请求时才渲染新帧。
+             * 需求由 setFramebufferDemandAsync 登记。
+             */
+            bool renderOnDemand;
+
+            /**
+             * 完全被遮挡的窗口每秒最多收到多少次 frame done。0 表示不发送。
+             */
+            int occludedFrameRate;
+
+            /**
+             * 根据画面变化频率，在 [minMilliHz, maxMilliHz] 之间自动调整虚拟屏幕的刷新率。
+             */
+            struct {
+                bool enabled;
+                int minMilliHz;
+                int maxMilliHz;
+            } adaptiveRefresh;
         } output = {0};
 
         struct {
             bool enabled = false;
-            int checkIntervalMs = 16;
         } runtimeCtrl;
 
 
@@ -131,7 +153,15 @@ public:
     void terminate();
 
     std::map<void*, wlr_buffer*> framebufferRentMap;
-    void* getFramebuffer(int displayIndex, vesper::bindings::pixman::Region32& damage);
+    /**
+     * 
+     * @param videoRegion nullable. 返回该帧中视频内容所在的区域。
+     */
+    void* getFramebuffer(
+        int displayIndex, 
+        vesper::common::TileBitmap& damage,
+        vesper::bindings::pixman::Region32* videoRegion = nullptr
+    );
     void recycleFramebuffer(void* oldFrameData, int displayIndex);
 
     /* ------ 运行过程中发送控制信息 ------ */
@@ -144,22 +174,50 @@ public:
 
     /**
      * 运行时指令格式。
-     * data 需要动态申请构造。f 为处理函数。
-     * f 内不需要考虑释放 data 的事情。eventloop 会自动释放非 nullptr 的 data。
+     * f 为处理函数。data 存放 f 的参数，随指令一起放在队列中，不需要另外申请内存。
+     * 参数须能按字节复制，且不超过 MAX_DATA_SIZE 字节。
      */
     struct RuntimeControlCmd {
-        std::function<void (Server*, void* data)> f;
-        RuntimeCtrlAsyncArgsBase* data;
+        static constexpr size_t MAX_DATA_SIZE = 56;
+
+        void (*f)(Server*, void* data);
+        alignas(8) unsigned char data[MAX_DATA_SIZE];
     };
 
     /**
-     * 运行时指令等待区。
+     * 运行时指令等待区。任意线程都可以放入指令。
+     * 放入后通过 eventFd 唤醒 wayland 事件循环，立即处理。
      */
     struct {
-        std::binary_semaphore lock {1};
-        std::queue<RuntimeControlCmd> waitingQueue {};
+        vesper::common::MpscRing<RuntimeControlCmd, 1024> queue;
+
+        /**
+         * queue 满时，不可丢弃的指令放在这里，加锁访问。
+         * overflowed 为 true 期间，新指令也都放在这里，保证先后顺序不乱。
+         */
+        std::mutex overflowMutex;
+        std::vector<RuntimeControlCmd> overflow;
+        std::atomic<bool> overflowed {false};
+
+        int eventFd = -1;
+
+        /**
+         * 已写过 eventFd，事件循环还没有开始处理。期间放入的指令不必再写。
+         * 初始为 true：eventFd 创建之前放入的指令，由 initRuntimeControl 统一唤醒。
+         */
+        std::atomic<bool> wakeupPending {true};
     } runtimeControlCmds;
 
+    /**
+     * 放入一条指令。
+     * 
+     * @param droppable 可丢弃的指令（如光标移动，后一条会覆盖前一条的效果）。
+     *                  队列已满时直接丢弃；否则改放入 overflow，不会丢失。
+     * @return 指令被丢弃时返回 false。
+     */
+    template<typename Args>
+    bool addRuntimeControlCmd(void (*f)(Server*, void* data), const Args& args, bool droppable = false);
+
 
     struct SetResolutionAsyncArgs : public RuntimeCtrlAsyncArgsBase {
         int index;
@@ -212,6 +270,31 @@ public:
     };
     int keyboardInputAsync(xkb_keysym_t keysym, bool pressed);
 
+
+    struct KeyboardScancodeInputAsyncArgs : public RuntimeCtrlAsyncArgsBase {
+        uint32_t scancode;
+        bool pressed;
+    };
+
+    /**
+     * 直接按下或松开一个物理按键。修饰键状态由 xkb 根据按键自行维护。
+     *
+     * @param scancode evdev 键码。
+     */
+    int keyboardScancodeInputAsync(uint32_t scancode, bool pressed);
+
+
+    struct SetFramebufferDemandAsyncArgs : public RuntimeCtrlAsyncArgsBase {
+        int displayIndex;
+        bool demand;
+    };
+
+    /**
+     * 设置某个屏幕当前是否有人在等待新画面（状态，而不是增减）。
+     * 仅在 options.output.renderOnDemand 启用时影响渲染。
+     */
+    int setFramebufferDemandAsync(int displayIndex, bool demand);
+
     int terminateAsync();
 
     /* ============ 对外方法 结束 ============ */
@@ -221,7 +304,8 @@ public:
 public:
 
     void clear();    
-    void runtimeControlEventLoop();  // run async
+    int initRuntimeControl();
+    void processRuntimeControlCmds();
 
 public:
     void newOutputEventHandler(wlr_output* newOutput);
@@ -248,6 +332,7 @@ public:
     wlr_renderer* wlrRenderer = nullptr;
     wlr_allocator* wlrAllocator = nullptr;
     wlr_output_layout* wlrOutputLayout = nullptr;
+    wlr_presentation* wlrPresentation = nullptr;
 
     vesper::desktop::scene::Scene* scene = nullptr;
     vesper::desktop::scene::OutputLayout* sceneLayout = nullptr;
@@ -274,7 +359,7 @@ public:
     wlr_seat* wlrSeat = nullptr;
 
 
-    wl_event_source* runtimeControlTimer = nullptr;
+    wl_event_source* runtimeControlEventSource = nullptr;
 
 public:
     struct {
@@ -16,6 +16,7 @@
 #include <set>
 #include <vector>
 #include <string>
+#include <algorithm>
 
 #include <signal.h>
 #include <fcntl.h>
@@ -106,11 +107,38 @@ static void loadPredefinedArgKeys() {
         { "--headless", true },
         { "--add-virtual-display" },
         { "--use-pixman-renderer", true },
+        { "--render-on-demand", true },
+        { "--adaptive-refresh", true },
+        { "--min-refresh-rate" },
+        { "--max-refresh-rate" },
+        { "--occluded-frame-rate" },
         { "--exec-cmds" },
         
         { "--enable-vnc", true },
         { "--vnc-port" },
+        { "--vnc-websocket", true },
+        { "--vnc-websocket-cert" },
+        { "--vnc-websocket-key" },
+        { "--vnc-websocket-send-buffer" },
+        { "--vnc-zero-copy", true },
+        { "--vnc-max-send-queue" },
+        { "--vnc-threaded-clients", true },
+        { "--vnc-extended-key-event", true },
         { "--libvncserver-passwd-file" },
+        { "--vnc-tile-hash-filter", true },
+        { "--vnc-content-aware-quality", true },
+        { "--vnc-video-detection", true },
+        { "--vnc-video-frame-rate" },
+        { "--vnc-lossless-refine-delay" },
+        { "--vnc-tile-cache-size" },
+        { "--vnc-shared-encoding", true },
+        { "--vnc-encode-threads" },
+        { "--vnc-h264", true },
+        { "--vnc-h264-bitrate" },
+        { "--vnc-h264-frame-rate" },
+        { "--thumbnail-size" },
+        { "--thumbnail-frame-rate" },
+        { "--thumbnail-quality" },
 
         { "--enable-ctrl", true },
         { "--ctrl-domain-socket" },
@@ -354,6 +382,51 @@ static int buildDesktopOptions() {
     options.output.exportScreenBuffer = globalOpts.enableVnc;
     options.output.forceRenderSoftwareCursor = false;  // todo
 
+    options.output.renderOnDemand = false;
+    if (args.flags.contains("--render-on-demand")) {
+        if (globalOpts.enableVnc) {
+            options.output.renderOnDemand = true;
+        } else {
+            LOG_WARN("--render-on-demand ignored: it requires --enable-vnc.");
+        }
+    }
+
+    options.output.occludedFrameRate = 0;
+    if (args.values.contains("--occluded-frame-rate")) {
+        try {
+            options.output.occludedFrameRate = max(stoi(args.values["--occluded-frame-rate"]), 0);
+        } catch (...) {
+            LOG_WARN("failed to parse --occluded-frame-rate. using default one.");
+        }
+    }
+
+    auto& adaptiveRefresh = options.output.adaptiveRefresh;
+    adaptiveRefresh.enabled = args.flags.contains("--adaptive-refresh");
+    adaptiveRefresh.minMilliHz = 10000;
+    adaptiveRefresh.maxMilliHz = 60000;
+
+    try {
+        if (args.values.contains("--min-refresh-rate")) {
+            adaptiveRefresh.minMilliHz = stoi(args.values["--min-refresh-rate"]) * 1000;
+        }
+
+        if (args.values.contains("--max-refresh-rate")) {
+            adaptiveRefresh.maxMilliHz = stoi(args.values["--max-refresh-rate"]) * 1000;
+        }
+    } catch (...) {
+        LOG_ERROR("failed to parse --min-refresh-rate or --max-refresh-rate.");
+        return 1;
+    }
+
+    if (adaptiveRefresh.minMilliHz <= 0 || adaptiveRefresh.minMilliHz > adaptiveRefresh.maxMilliHz) {
+        LOG_ERROR("bad refresh rate range: ", adaptiveRefresh.minMilliHz / 1000, " ~ ", adaptiveRefresh.maxMilliHz / 1000);
+        return 1;
+    }
+
+    if (adaptiveRefresh.enabled && !options.backend.headless) {
+        LOG_WARN("--adaptive-refresh only affects virtual displays.");
+    }
+
     return 0;
 
 }
@@ -377,6 +450,38 @@ static int buildVncOptions() {
         }
     }
 
+    auto& websocket = options.net.websocket;
+    websocket.enabled = args.flags.contains("--vnc-websocket");
+
+    if (args.values.contains("--vnc-websocket-cert")) {
+        websocket.certFile = args.values["--vnc-websocket-cert"];
+    }
+
+    if (args.values.contains("--vnc-websocket-key")) {
+        websocket.keyFile = args.values["--vnc-websocket-key"];
+    }
+
+    websocket.sendBufferKb = 4096;
+    if (args.values.contains("--vnc-websocket-send-buffer")) {
+        try {
+            websocket.sendBufferKb = max(stoi(args.values["--vnc-websocket-send-buffer"]), 0);
+        } catch (...) {
+            LOG_WARN("failed to parse --vnc-websocket-send-buffer. using default one.");
+        }
+    }
+
+    if (args.values.contains("--vnc-max-send-queue")) {
+        try {
+            options.net.maxSendQueueKb = max(stoi(args.values["--vnc-max-send-queue"]), 0);
+        } catch (...) {
+            LOG_WARN("failed to parse --vnc-max-send-queue. send queue not limited.");
+        }
+    }
+
+    options.net.threadedClients = args.flags.contains("--vnc-threaded-clients");
+
+    options.input.extendedKeyEvent = args.flags.contains("--vnc-extended-key-event");
+
 
     const char* vncPwEnvKey = "VESPER_VNC_AUTH_PASSWD";
     bool envHasVNCPw = args.env.contains(vncPwEnvKey);
@@ -393,14 +498,111 @@ static int buildVncOptions() {
         options.auth.libvncserverPasswdFile += args.values[libvncserverPasswdFile];
     }
     
-    options.screenBuffer.getBuffer = [] (pixman::Region32& damage) -> void* {
-        return servers.desktop.getFramebuffer(0, damage);
+    options.screenBuffer.getBuffer = [] (
+        TileBitmap& damage, pixman::Region32* videoRegion
+    ) -> void* {
+        return servers.desktop.getFramebuffer(0, damage, videoRegion);
     };
 
+    options.encoding.tileHashFilter = args.flags.contains("--vnc-tile-hash-filter");
+    options.encoding.contentAwareQuality = args.flags.contains("--vnc-content-aware-quality");
+    options.encoding.videoDetection = args.flags.contains("--vnc-video-detection");
+
+    if (args.values.contains("--vnc-video-frame-rate")) {
+        try {
+            options.encoding.videoFrameRate = max(stoi(args.values["--vnc-video-frame-rate"]), 0);
+        } catch (...) {
+            LOG_WARN("failed to parse --vnc-video-frame-rate. using default one.");
+        }
+    }
+
+    if (args.values.contains("--vnc-lossless-refine-delay")) {
+        try {
+            options.encoding.losslessRefineDelayMs = max(stoi(args.values["--vnc-lossless-refine-delay"]), 0);
+        } catch (...) {
+            LOG_WARN("failed to parse --vnc-lossless-refine-delay. lossless refinement disabled.");
+        }
+    }
+
+    if (args.values.contains("--vnc-tile-cache-size")) {
+        try {
+            options.encoding.tileCacheSize = max(stoi(args.values["--vnc-tile-cache-size"]), 0);
+        } catch (...) {
+            LOG_WARN("failed to parse --vnc-tile-cache-size. tile cache disabled.");
+        }
+    }
+
+    options.encoding.sharedEncoding = args.flags.contains("--vnc-shared-encoding");
+
+    if (args.values.contains("--vnc-encode-threads")) {
+        try {
+            options.encoding.encodeThreads = max(stoi(args.values["--vnc-encode-threads"]), 1);
+        } catch (...) {
+            LOG_WARN("failed to parse --vnc-encode-threads. using default one.");
+        }
+    }
+
+    options.encoding.h264.enabled = args.flags.contains("--vnc-h264");
+
+    if (args.values.contains("--vnc-h264-bitrate")) {
+        try {
+            options.encoding.h264.bitrateKbps = max(stoi(args.values["--vnc-h264-bitrate"]), 100);
+        } catch (...) {
+            LOG_WARN("failed to parse --vnc-h264-bitrate. using default one.");
+        }
+    }
+
+    if (args.values.contains("--vnc-h264-frame-rate")) {
+        try {
+            options.encoding.h264.frameRate = clamp(stoi(args.values["--vnc-h264-frame-rate"]), 1, 60);
+        } catch (...) {
+            LOG_WARN("failed to parse --vnc-h264-frame-rate. using default one.");
+        }
+    }
+
+    options.net.zeroCopy = args.flags.contains("--vnc-zero-copy");
+    if (options.net.zeroCopy && !options.encoding.sharedEncoding) {
+        LOG_WARN("--vnc-zero-copy ignored: it requires --vnc-shared-encoding.");
+        options.net.zeroCopy = false;
+    }
+
+    if (args.values.contains("--thumbnail-size")) {
+        string size = args.values["--thumbnail-size"];
+        size_t posOfStar = size.find('*');
+
+        if (posOfStar == string::npos) {
+            LOG_WARN("failed to parse --thumbnail-size. thumbnail disabled.");
+        } else {
+            try {
+                options.thumbnail.width = stoi(size.substr(0, posOfStar));
+                options.thumbnail.height = stoi(size.substr(posOfStar + 1));
+            } catch (...) {
+                LOG_WARN("failed to parse --thumbnail-size. thumbnail disabled.");
+                options.thumbnail.width = options.thumbnail.height = 0;
+            }
+        }
+    }
+
+    try {
+        if (args.values.contains("--thumbnail-frame-rate")) {
+            options.thumbnail.frameRate = max(stoi(args.values["--thumbnail-frame-rate"]), 0);
+        }
+
+        if (args.values.contains("--thumbnail-quality")) {
+            options.thumbnail.quality = stoi(args.values["--thumbnail-quality"]);
+        }
+    } catch (...) {
+        LOG_WARN("failed to parse --thumbnail-frame-rate or --thumbnail-quality. using default ones.");
+    }
+
     options.screenBuffer.recycleBuffer = [] (void* buf) {
         servers.desktop.recycleFramebuffer(buf, 0);
     };
 
+    options.screenBuffer.demandChanged = [] (bool demand) {
+        servers.desktop.setFramebufferDemandAsync(0, demand);
+    };
+
     servers.vnc.options.eventHandlers.mouse.motion = [] (
         bool absolute, double absoluteX, double absoluteY,
         bool delta, int deltaX, int deltaY
@@ -428,6 +630,12 @@ static int buildVncOptions() {
         servers.desktop.keyboardInputAsync(keysym, pressed);
     };
 
+    servers.vnc.options.eventHandlers.keyboard.scancode = [] (
+        bool pressed, uint32_t scancode
+    ) {
+        servers.desktop.keyboardScancodeInputAsync(scancode, pressed);
+    };
+
     return 0;
 }
 
@@ -470,6 +678,10 @@ static int buildControlOptions() {
         return servers.vnc.options.auth.password;
     };
 
+    options.hooks.getThumbnail = [] (string& jpeg) {
+        return servers.vnc.getThumbnail(jpeg);
+    };
+
     return 0;
 }
 
@@ -10,247 +10,405 @@
 #include "./XKeysymToEvdevScancode.h"
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <algorithm>
 
 #include <linux/input-event-codes.h>
 #include <xkbcommon/xkbcommon.h>
 
 using namespace std;
 
-static map<xkb_keysym_t, uint32_t> keymap;
-static set<xkb_keysym_t> modifierSet;
-static bool ready = false;
+namespace {
 
-static void buildKeymap() {
+struct Entry {
+    xkb_keysym_t keysym;
+    uint32_t scancode;
+};
 
-    /*
+} // namespace
 
-    下方映射表由代码辅助生成：
-    
-        #include <fstream>
-        map<xkb_keysym_t, uint32_t> revMap;
-        void dump() {
-            auto out = ofstream("map.cpp", ios::binary | ios::out);
-            for (auto& it : revMap) {
-                out << "    keymap[" << it.first << "] = " << it.second << ";" << endl;
-            }
-            out.close();
+
+/*
+
+下方映射表由代码辅助生成：
+
+    #include <fstream>
+    map<xkb_keysym_t, uint32_t> revMap;
+    void dump() {
+        auto out = ofstream("map.cpp", ios::binary | ios::out);
+        for (auto& it : revMap) {
+            out << "    { " << it.first << ", " << it.second << " }," << endl;
         }
+        out.close();
+    }
 
-        ...
+    ...
 
-        static void onKeyPress(...) {
-            ...
-            if (event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
-                if (revMap.count(sym)) {
-                    // ignored.
-                } else {
-                    revMap[sym] = event->keycode; // 录入
-                }
+    static void onKeyPress(...) {
+        ...
+        if (event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
+            if (revMap.count(sym)) {
+                // ignored.
+            } else {
+                revMap[sym] = event->keycode; // 录入
             }
-            ...
         }
+        ...
+    }
+
+*/
+
+static constexpr Entry usEntries[] = {
+    { 32, 57 },
+    { 33, 2 },
+    { 34, 40 },
+    { 35, 4 },
+    { 36, 5 },
+    { 37, 6 },
+    { 38, 8 },
+    { 39, 40 },
+    { 40, 10 },
+    { 41, 11 },
+    { 42, 9 },
+    { 43, 13 },
+    { 44, 51 },
+    { 45, 12 },
+    { 46, 52 },
+    { 47, 53 },
+    { 48, 11 },
+    { 49, 2 },
+    { 50, 3 },
+    { 51, 4 },
+    { 52, 5 },
+    { 53, 6 },
+    { 54, 7 },
+    { 55, 8 },
+    { 56, 9 },
+    { 57, 10 },
+    { 58, 39 },
+    { 59, 39 },
+    { 60, 51 },
+    { 61, 13 },
+    { 62, 52 },
+    { 63, 53 },
+    { 64, 3 },
+    { 65, 30 },
+    { 66, 48 },
+    { 67, 46 },
+    { 68, 32 },
+    { 69, 18 },
+    { 70, 33 },
+    { 71, 34 },
+    { 72, 35 },
+    { 73, 23 },
+    { 74, 36 },
+    { 75, 37 },
+    { 76, 38 },
+    { 77, 50 },
+    { 78, 49 },
+    { 79, 24 },
+    { 80, 25 },
+    { 81, 16 },
+    { 82, 19 },
+    { 83, 31 },
+    { 84, 20 },
+    { 85, 22 },
+    { 86, 47 },
+    { 87, 17 },
+    { 88, 45 },
+    { 89, 21 },
+    { 90, 44 },
+    { 91, 26 },
+    { 92, 43 },
+    { 93, 27 },
+    { 94, 7 },
+    { 95, 12 },
+    { 96, 41 },
+    { 97, 30 },
+    { 98, 48 },
+    { 99, 46 },
+    { 100, 32 },
+    { 101, 18 },
+    { 102, 33 },
+    { 103, 34 },
+    { 104, 35 },
+    { 105, 23 },
+    { 106, 36 },
+    { 107, 37 },
+    { 108, 38 },
+    { 109, 50 },
+    { 110, 49 },
+    { 111, 24 },
+    { 112, 25 },
+    { 113, 16 },
+    { 114, 19 },
+    { 115, 31 },
+    { 116, 20 },
+    { 117, 22 },
+    { 118, 47 },
+    { 119, 17 },
+    { 120, 45 },
+    { 121, 21 },
+    { 122, 44 },
+    { 123, 26 },
+    { 124, 43 },
+    { 125, 27 },
+    { 126, 41 },
+    { 65288, 14 },
+    { 65289, 15 },
+    { 65293, 28 },
+    { 65299, 119 },
+    { 65300, 70 },
+    { 65307, 1 },
+    { 65360, 102 },
+    { 65361, 105 },
+    { 65362, 103 },
+    { 65363, 106 },
+    { 65364, 108 },
+    { 65365, 104 },
+    { 65366, 109 },
+    { 65367, 107 },
+    { 65379, 110 },
+    { 65407, 69 },
+    { 65421, 96 },
+    { 65450, 55 },
+    { 65451, 78 },
+    { 65453, 74 },
+    { 65454, 83 },
+    { 65455, 98 },
+    { 65456, 82 },
+    { 65457, 79 },
+    { 65458, 80 },
+    { 65459, 81 },
+    { 65460, 75 },
+    { 65461, 76 },
+    { 65462, 77 },
+    { 65463, 71 },
+    { 65464, 72 },
+    { 65465, 73 },
+    { 65470, 59 },
+    { 65471, 60 },
+    { 65472, 61 },
+    { 65473, 62 },
+    { 65474, 63 },
+    { 65475, 64 },
+    { 65476, 65 },
+    { 65477, 66 },
+    { 65478, 67 },
+    { 65479, 68 },
+    { 65480, 87 },
+    { 65481, 88 },
+    { 65505, 42 },
+    { 65506, 54 },
+    { 65507, 29 },
+    { 65508, 97 },
+    { 65509, 58 },
+    { 65513, 56 },
+    { 65514, 100 },
+    { 65515, 125 },
+    { 65516, 126 },
+    { 65535, 111 },
+};
+
+
+/*
+
+下方集合由代码辅助生成：
+
+    #include <fstream>
+    #include <set>
+    set<xkb_keysym_t> modifierSet;
+    xkb_keysym_t prevKeysym;
+    void dump() {
+        auto out = ofstream("set.cpp", ios::binary | ios::out);
+        for (auto& it : modifierSet) {
+            out << "    " << it << "," << endl;
+        }
+        out.close();
+    }
 
-    */
-
-    keymap[32] = 57;
-    keymap[33] = 2;
-    keymap[34] = 40;
-    keymap[35] = 4;
-    keymap[36] = 5;
-    keymap[37] = 6;
-    keymap[38] = 8;
-    keymap[39] = 40;
-    keymap[40] = 10;
-    keymap[41] = 11;
-    keymap[42] = 9;
-    keymap[43] = 13;
-    keymap[44] = 51;
-    keymap[45] = 12;
-    keymap[46] = 52;
-    keymap[47] = 53;
-    keymap[48] = 11;
-    keymap[49] = 2;
-    keymap[50] = 3;
-    keymap[51] = 4;
-    keymap[52] = 5;
-    keymap[53] = 6;
-    keymap[54] = 7;
-    keymap[55] = 8;
-    keymap[56] = 9;
-    keymap[57] = 10;
-    keymap[58] = 39;
-    keymap[59] = 39;
-    keymap[60] = 51;
-    keymap[61] = 13;
-    keymap[62] = 52;
-    keymap[63] = 53;
-    keymap[64] = 3;
-    keymap[65] = 30;
-    keymap[66] = 48;
-    keymap[67] = 46;
-    keymap[68] = 32;
-    keymap[69] = 18;
-    keymap[70] = 33;
-    keymap[71] = 34;
-    keymap[72] = 35;
-    keymap[73] = 23;
-    keymap[74] = 36;
-    keymap[75] = 37;
-    keymap[76] = 38;
-    keymap[77] = 50;
-    keymap[78] = 49;
-    keymap[79] = 24;
-    keymap[80] = 25;
-    keymap[81] = 16;
-    keymap[82] = 19;
-    keymap[83] = 31;
-    keymap[84] = 20;
-    keymap[85] = 22;
-    keymap[86] = 47;
-    keymap[87] = 17;
-    keymap[88] = 45;
-    keymap[89] = 21;
-    keymap[90] = 44;
-    keymap[91] = 26;
-    keymap[92] = 43;
-    keymap[93] = 27;
-    keymap[94] = 7;
-    keymap[95] = 12;
-    keymap[96] = 41;
-    keymap[97] = 30;
-    keymap[98] = 48;
-    keymap[99] = 46;
-    keymap[100] = 32;
-    keymap[101] = 18;
-    keymap[102] = 33;
-    keymap[103] = 34;
-    keymap[104] = 35;
-    keymap[105] = 23;
-    keymap[106] = 36;
-    keymap[107] = 37;
-    keymap[108] = 38;
-    keymap[109] = 50;
-    keymap[110] = 49;
-    keymap[111] = 24;
-    keymap[112] = 25;
-    keymap[113] = 16;
-    keymap[114] = 19;
-    keymap[115] = 31;
-    keymap[116] = 20;
-    keymap[117] = 22;
-    keymap[118] = 47;
-    keymap[119] = 17;
-    keymap[120] = 45;
-    keymap[121] = 21;
-    keymap[122] = 44;
-    keymap[123] = 26;
-    keymap[124] = 43;
-    keymap[125] = 27;
-    keymap[126] = 41;
-    keymap[65288] = 14;
-    keymap[65289] = 15;
-    keymap[65293] = 28;
-    keymap[65299] = 119;
-    keymap[65300] = 70;
-    keymap[65307] = 1;
-    keymap[65360] = 102;
-    keymap[65361] = 105;
-    keymap[65362] = 103;
-    keymap[65363] = 106;
-    keymap[65364] = 108;
-    keymap[65365] = 104;
-    keymap[65366] = 109;
-    keymap[65367] = 107;
-    keymap[65379] = 110;
-    keymap[65407] = 69;
-    keymap[65421] = 96;
-    keymap[65450] = 55;
-    keymap[65451] = 78;
-    keymap[65453] = 74;
-    keymap[65454] = 83;
-    keymap[65455] = 98;
-    keymap[65456] = 82;
-    keymap[65457] = 79;
-    keymap[65458] = 80;
-    keymap[65459] = 81;
-    keymap[65460] = 75;
-    keymap[65461] = 76;
-    keymap[65462] = 77;
-    keymap[65463] = 71;
-    keymap[65464] = 72;
-    keymap[65465] = 73;
-    keymap[65470] = 59;
-    keymap[65471] = 60;
-    keymap[65472] = 61;
-    keymap[65473] = 62;
-    keymap[65474] = 63;
-    keymap[65475] = 64;
-    keymap[65476] = 65;
-    keymap[65477] = 66;
-    keymap[65478] = 67;
-    keymap[65479] = 68;
-    keymap[65480] = 87;
-    keymap[65481] = 88;
-    keymap[65505] = 42;
-    keymap[65506] = 54;
-    keymap[65507] = 29;
-    keymap[65508] = 97;
-    keymap[65509] = 58;
-    keymap[65513] = 56;
-    keymap[65514] = 100;
-    keymap[65515] = 125;
-    keymap[65516] = 126;
-    keymap[65535] = 111;
+*/
 
+static constexpr xkb_keysym_t modifierKeysyms[] = {
+    65407,
+    65505,
+    65506,
+    65507,
+    65508,
+    65509,
+    65513,
+    65514,
+    65515,
+    65516,
+};
+
+
+/*
+ * 美式布局的反查表在编译期构建为完美哈希（hash and displace）：
+ * 先用 keysymHash(keysym, 0) 把 keysym 分到各个桶中，再为每个桶找一个种子，
+ * 使桶内所有 keysym 经 keysymHash(keysym, 种子) 落到互不冲突的空槽。
+ * 查找时只需计算两次哈希、比较一个槽。
+ */
+
+static constexpr size_t BUCKET_COUNT = 64;
+static constexpr size_t SLOT_COUNT = 256;
+
+static_assert(size(usEntries) <= SLOT_COUNT);
+
+static constexpr uint32_t keysymHash(uint32_t key, uint32_t seed) {
+    uint32_t h = key ^ (seed * 0x9E3779B9u);
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
 }
 
-static void buildModifierSet() {
+static constexpr size_t bucketOf(xkb_keysym_t keysym) {
+    return keysymHash(keysym, 0) % BUCKET_COUNT;
+}
 
-    /*
-    
-    下方映射表由代码辅助生成：
-
-        #include <fstream>
-        #include <set>
-        set<xkb_keysym_t> modifierSet;
-        xkb_keysym_t prevKeysym;
-        void dump() {
-            auto out = ofstream("set.cpp", ios::binary | ios::out);
-            for (auto& it : modifierSet) {
-                out << "    modifierSet.insert(" << it << ");" << endl;
+namespace {
+
+struct PerfectHashTable {
+    uint32_t seeds[BUCKET_COUNT] {};
+
+    /** 空槽的 keysym 为 0（XKB_KEY_NoSymbol）。 */
+    Entry slots[SLOT_COUNT] {};
+
+    bool complete = false;
+};
+
+} // namespace
+
+static constexpr PerfectHashTable buildPerfectHashTable() {
+    PerfectHashTable table;
+
+    size_t bucketSizes[BUCKET_COUNT] {};
+    for (auto& entry : usEntries) {
+        bucketSizes[bucketOf(entry.keysym)]++;
+    }
+
+    // 大桶先放。越往后空槽越少，小桶更容易找到种子。
+
+    size_t order[BUCKET_COUNT] {};
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        order[i] = i;
+    }
+
+    for (size_t i = 1; i < BUCKET_COUNT; i++) {
+        for (size_t j = i; j > 0 && bucketSizes[order[j]] > bucketSizes[order[j - 1]]; j--) {
+            swap(order[j], order[j - 1]);
+        }
+    }
+
+    bool used[SLOT_COUNT] {};
+
+    for (size_t bucket : order) {
+        if (bucketSizes[bucket] == 0) {
+            continue;
+        }
+
+        bool placed = false;
+
+        for (uint32_t seed = 1; seed < 65536 && !placed; seed++) {
+            size_t slots[size(usEntries)] {};
+            size_t count = 0;
+            bool collided = false;
+
+            for (auto& entry : usEntries) {
+                if (bucketOf(entry.keysym) != bucket) {
+                    continue;
+                }
+
+                size_t slot = keysymHash(entry.keysym, seed) % SLOT_COUNT;
+                collided = used[slot] || find(slots, slots + count, slot) != slots + count;
+                if (collided) {
+                    break;
+                }
+
+                slots[count++] = slot;
+            }
+
+            if (collided) {
+                continue;
+            }
+
+            count = 0;
+            for (auto& entry : usEntries) {
+                if (bucketOf(entry.keysym) == bucket) {
+                    table.slots[slots[count]] = entry;
+                    used[slots[count++]] = true;
+                }
             }
-            out.close();
+
+            table.seeds[bucket] = seed;
+            placed = true;
+        }
+
+        if (!placed) {
+            return table;
         }
+    }
 
-    */
-
-    modifierSet.insert(65407);
-    modifierSet.insert(65505);
-    modifierSet.insert(65506);
-    modifierSet.insert(65507);
-    modifierSet.insert(65508);
-    modifierSet.insert(65509);
-    modifierSet.insert(65513);
-    modifierSet.insert(65514);
-    modifierSet.insert(65515);
-    modifierSet.insert(65516);
+    table.complete = true;
+    return table;
 }
 
-static void prepare() {
-    if (!ready) {
-        buildKeymap();
-        buildModifierSet();
-        ready = true;
+static constexpr PerfectHashTable usTable = buildPerfectHashTable();
+
+static_assert(usTable.complete, "failed to build perfect hash table for US keymap.");
+
+
+/** 当前键盘布局的反查表。为空时只使用美式布局。 */
+static unordered_map<xkb_keysym_t, uint32_t> layoutKeymap;
+
+
+void xKeysymUseKeymap(xkb_keymap* keymap) {
+    layoutKeymap.clear();
+
+    if (keymap == nullptr) {
+        return;
+    }
+
+    xkb_keycode_t minKeycode = xkb_keymap_min_keycode(keymap);
+    xkb_keycode_t maxKeycode = xkb_keymap_max_keycode(keymap);
+
+    // 逐级遍历，同一 keysym 优先取不需要 shift 等修饰键的按键。
+
+    xkb_level_index_t maxLevels = 0;
+    for (xkb_keycode_t keycode = minKeycode; keycode <= maxKeycode; keycode++) {
+        maxLevels = max(maxLevels, xkb_keymap_num_levels_for_key(keymap, keycode, 0));
+    }
+
+    for (xkb_level_index_t level = 0; level < maxLevels; level++) {
+        for (xkb_keycode_t keycode = max(minKeycode, 8u); keycode <= maxKeycode; keycode++) {
+            const xkb_keysym_t* syms;
+            int count = xkb_keymap_key_get_syms_by_level(keymap, keycode, 0, level, &syms);
+
+            for (int i = 0; i < count; i++) {
+                layoutKeymap.emplace(syms[i], keycode - 8);  // xkb 键码比 evdev 键码大 8。
+            }
+        }
     }
 }
 
+
 uint32_t xKeysymToEvdevScancode(xkb_keysym_t keysym) {
-    prepare();
-    return keymap.count(keysym) ? keymap[keysym] : 0;
+    if (!layoutKeymap.empty()) {
+        auto it = layoutKeymap.find(keysym);
+        if (it != layoutKeymap.end()) {
+            return it->second;
+        }
+    }
+
+    const Entry& entry = usTable.slots[keysymHash(keysym, usTable.seeds[bucketOf(keysym)]) % SLOT_COUNT];
+    return entry.keysym == keysym ? entry.scancode : 0;
 }
 
 bool xKeysymIsModifier(xkb_keysym_t keysym) {
-    return modifierSet.contains(keysym);
+    return find(begin(modifierKeysyms), end(modifierKeysyms), keysym) != end(modifierKeysyms);
 }
 
 
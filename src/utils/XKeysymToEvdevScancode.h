@@ -11,6 +11,16 @@
 #include <cstdint>
 #include <xkbcommon/xkbcommon.h>
 
+/**
+ * 根据正在使用的键盘布局重建反查表。该布局中找不到的 keysym 仍按美式布局反查。
+ *
+ * @param keymap 为 nullptr 时只按美式布局反查。
+ */
+void xKeysymUseKeymap(xkb_keymap* keymap);
+
+/**
+ * @return 找不到对应按键时返回 0。
+ */
 std::uint32_t xKeysymToEvdevScancode(xkb_keysym_t keysym);
 bool xKeysymIsModifier(xkb_keysym_t keysym);
 bool scancodeToXkbModIndex(
@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 将 XT 扫描码（Set 1）转换为 evdev 键码
+ * 
+ * 创建于 2026年10月19日
+ */
+
+#include "./XtScancodeToEvdevScancode.h"
+
+#include <array>
+#include <linux/input-event-codes.h>
+
+using namespace std;
+
+static constexpr uint32_t EXTENDED = 0x80;
+
+static constexpr array<uint16_t, 256> buildTable() {
+    array<uint16_t, 256> table {};
+
+    // 0x01（Esc）到 0x53（小键盘 .）与 evdev 键码一致。
+
+    for (uint32_t code = 0x01; code <= 0x53; code++) {
+        table[code] = uint16_t(code);
+    }
+
+    table[0x54] = KEY_SYSRQ;  // Alt + PrintScreen
+    table[0x55] = KEY_F16;
+    table[0x56] = KEY_102ND;
+    table[0x57] = KEY_F11;
+    table[0x58] = KEY_F12;
+    table[0x59] = KEY_KPEQUAL;
+    table[0x5C] = KEY_KPJPCOMMA;
+    table[0x5D] = KEY_F13;
+    table[0x5E] = KEY_F14;
+    table[0x5F] = KEY_F15;
+    table[0x70] = KEY_KATAKANAHIRAGANA;
+    table[0x71] = KEY_HANJA;
+    table[0x72] = KEY_HANGEUL;
+    table[0x73] = KEY_RO;
+    table[0x76] = KEY_ZENKAKUHANKAKU;
+    table[0x77] = KEY_HIRAGANA;
+    table[0x78] = KEY_KATAKANA;
+    table[0x79] = KEY_HENKAN;
+    table[0x7B] = KEY_MUHENKAN;
+    table[0x7D] = KEY_YEN;
+    table[0x7E] = KEY_KPCOMMA;
+
+    // 0xE0 开头的扩展键。
+
+    table[EXTENDED | 0x10] = KEY_PREVIOUSSONG;
+    table[EXTENDED | 0x19] = KEY_NEXTSONG;
+    table[EXTENDED | 0x1C] = KEY_KPENTER;
+    table[EXTENDED | 0x1D] = KEY_RIGHTCTRL;
+    table[EXTENDED | 0x20] = KEY_MUTE;
+    table[EXTENDED | 0x21] = KEY_CALC;
+    table[EXTENDED | 0x22] = KEY_PLAYPAUSE;
+    table[EXTENDED | 0x24] = KEY_STOPCD;
+    table[EXTENDED | 0x2E] = KEY_VOLUMEDOWN;
+    table[EXTENDED | 0x30] = KEY_VOLUMEUP;
+    table[EXTENDED | 0x32] = KEY_HOMEPAGE;
+    table[EXTENDED | 0x35] = KEY_KPSLASH;
+    table[EXTENDED | 0x37] = KEY_SYSRQ;  // PrintScreen
+    table[EXTENDED | 0x38] = KEY_RIGHTALT;
+    table[EXTENDED | 0x46] = KEY_PAUSE;  // Ctrl + Break
+    table[EXTENDED | 0x47] = KEY_HOME;
+    table[EXTENDED | 0x48] = KEY_UP;
+    table[EXTENDED | 0x49] = KEY_PAGEUP;
+    table[EXTENDED | 0x4B] = KEY_LEFT;
+    table[EXTENDED | 0x4D] = KEY_RIGHT;
+    table[EXTENDED | 0x4F] = KEY_END;
+    table[EXTENDED | 0x50] = KEY_DOWN;
+    table[EXTENDED | 0x51] = KEY_PAGEDOWN;
+    table[EXTENDED | 0x52] = KEY_INSERT;
+    table[EXTENDED | 0x53] = KEY_DELETE;
+    table[EXTENDED | 0x5B] = KEY_LEFTMETA;
+    table[EXTENDED | 0x5C] = KEY_RIGHTMETA;
+    table[EXTENDED | 0x5D] = KEY_COMPOSE;
+    table[EXTENDED | 0x5E] = KEY_POWER;
+    table[EXTENDED | 0x5F] = KEY_SLEEP;
+    table[EXTENDED | 0x63] = KEY_WAKEUP;
+    table[EXTENDED | 0x65] = KEY_SEARCH;
+    table[EXTENDED | 0x66] = KEY_BOOKMARKS;
+    table[EXTENDED | 0x67] = KEY_REFRESH;
+    table[EXTENDED | 0x68] = KEY_STOP;
+    table[EXTENDED | 0x69] = KEY_FORWARD;
+    table[EXTENDED | 0x6A] = KEY_BACK;
+    table[EXTENDED | 0x6B] = KEY_COMPUTER;
+    table[EXTENDED | 0x6C] = KEY_MAIL;
+    table[EXTENDED | 0x6D] = KEY_MEDIA;
+
+    return table;
+}
+
+static constexpr auto table = buildTable();
+
+
+uint32_t xtScancodeToEvdevScancode(uint32_t xtScancode) {
+    if (xtScancode >= table.size()) {
+        return 0;
+    }
+
+    return table[xtScancode];
+}
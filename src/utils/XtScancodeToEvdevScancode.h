@@ -0,0 +1,19 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 将 XT 扫描码（Set 1）转换为 evdev 键码
+ * 
+ * 创建于 2026年10月19日
+ *
+ * XT 扫描码采用 QEMU Extended Key Event 的编码方式：
+ * 单字节扫描码原样保存；0xE0 开头的双字节扫描码，保存为第二个字节并置最高位。
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @return 没有对应的 evdev 键码时返回 0。
+ */
+std::uint32_t xtScancodeToEvdevScancode(std::uint32_t xtScancode);
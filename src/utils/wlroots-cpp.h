@@ -35,6 +35,9 @@ extern "C" {
     #include <wlr/types/wlr_buffer.h>
     #include <wlr/types/wlr_presentation_time.h>
     #include <wlr/types/wlr_linux_dmabuf_v1.h>
+    #include <wlr/types/wlr_viewporter.h>
+    #include <wlr/types/wlr_single_pixel_buffer_v1.h>
+    #include <wlr/types/wlr_content_type_v1.h>
 
     #include <wlr/types/wlr_fractional_scale_v1.h>
 
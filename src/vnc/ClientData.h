@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * VNC 客户端附加数据
+ *
+ * 创建于 2026年10月18日
+ *
+ * 挂在 rfbClientRec::clientData 上，记录 vesper 为每个客户端单独维护的状态。
+ * 在 newClientHook 中创建，在 clientGoneHook 中释放。
+ */
+
+#pragma once
+
+#include "../bindings/pixman.h"
+#include "./TileCache.h"
+#include "./ZeroCopySender.h"
+#include "./H264Encoder.h"
+
+#include <rfb/rfb.h>
+
+#include <mutex>
+#include <memory>
+#include <cstdint>
+
+namespace vesper::vnc {
+
+struct ClientData {
+
+    /**
+     * 多线程模式下，客户端线程（displayHook 等）与主循环都会访问下面的字段。
+     * 同时需要客户端的 updateMutex 时，先取得 updateMutex。
+     */
+    std::mutex mutex;
+
+    /**
+     * 客户端自己通过 SetEncodings 请求的 JPEG 质量（TurboVNC 的 1-100 标尺）。
+     * -1 表示客户端没有请求有损编码。
+     */
+    int preferredQuality = -1;
+
+    /**
+     * preferredQuality 来自第几条 SetEncodings。
+     * turboQualityLevel 会被 vesper 改写，只能靠计数得知客户端重新发送了 SetEncodings。
+     */
+    int qualitySetEncodingsCount = 0;
+
+    /** 最近一次以有损方式发送、之后还没有被无损覆盖的区域。 */
+    vesper::bindings::pixman::Region32 lossyRegion;
+
+    /** 最近一次以有损方式发送画面的时间（纳秒）。 */
+    int64_t lastLossyNsec = 0;
+
+    /** 正在以无损方式重发 lossyRegion。 */
+    bool refining = false;
+
+    /** 正在发送的这次更新。由 displayHook 记录，displayFinishedHook 使用。 */
+    struct {
+        vesper::bindings::pixman::Region32 region;
+        bool lossy = false;
+    } sending;
+
+    /** 客户端已保存的块。客户端没有声明支持时容量为 0。 */
+    TileCache tileCache;
+
+    /** tileCache 中的块是以什么像素格式发给客户端的。格式改变后须清空。 */
+    rfbPixelFormat tileCacheFormat {};
+
+    /** 共享编码路径发送大消息时使用。未开启时不可用。 */
+    ZeroCopySender zeroCopy;
+
+    /** socket 发送队列积压过多，暂不发送画面。 */
+    bool congested = false;
+
+    /** 积压期间推迟发送的区域。积压消除后放回 modifiedRegion，按最新画面编码。 */
+    vesper::bindings::pixman::Region32 deferredRegion;
+
+    /** Open H.264 编码。 */
+    struct {
+        /** 客户端把 Open H.264 放在所有其他编码之前。 */
+        bool requested = false;
+
+        /**
+         * requested 来自第几条 SetEncodings。
+         * 之后收到的 SetEncodings 没有列出 Open H.264 时，libvncserver 不会通知扩展，靠计数得知。
+         */
+        int setEncodingsCount = 0;
+
+        /** 第一次发送时创建。 */
+        std::unique_ptr<H264Encoder> encoder;
+
+        /** 下一帧须让客户端重置解码器。 */
+        bool resetPending = false;
+
+        int64_t lastFrameNsec = 0;
+
+        /** 等待下一帧发送的区域。不交给 libvncserver，以免按其他编码发送。 */
+        vesper::bindings::pixman::Region32 pending;
+    } h264;
+
+};
+
+} // namespace vesper::vnc
@@ -0,0 +1,400 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 已编码分块缓存
+ *
+ * 创建于 2026年10月18日
+ */
+
+#include "./EncodedTileCache.h"
+
+#include <algorithm>
+#include <atomic>
+
+using namespace std;
+using namespace vesper::common;
+
+namespace vesper::vnc {
+
+
+static bool sameFormat(const rfbPixelFormat& a, const rfbPixelFormat& b) {
+    return a.bitsPerPixel == b.bitsPerPixel
+        && a.depth == b.depth
+        && a.bigEndian == b.bigEndian
+        && a.trueColour == b.trueColour
+        && a.redMax == b.redMax
+        && a.greenMax == b.greenMax
+        && a.blueMax == b.blueMax
+        && a.redShift == b.redShift
+        && a.greenShift == b.greenShift
+        && a.blueShift == b.blueShift;
+}
+
+
+EncodedTileCache::EncodedTileCache() {
+    encoders.push_back(make_unique<Encoder>());
+}
+
+
+EncodedTileCache::~EncodedTileCache() {
+    stopWorkers();
+}
+
+
+EncodedTileCache::Encoder::~Encoder() {
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+    for (int i = 0; i < 10; i++) {
+        if (streamInited[i]) {
+            deflateEnd(&streams[i]);
+            streamInited[i] = false;
+        }
+    }
+#endif
+}
+
+
+void EncodedTileCache::resize(int width, int height) {
+    this->width = max(width, 0);
+    this->height = max(height, 0);
+
+    columns = (this->width + TILE_SIZE - 1) / TILE_SIZE;
+    rows = (this->height + TILE_SIZE - 1) / TILE_SIZE;
+
+    tiles.clear();
+    tiles.resize(size_t(columns) * rows);
+}
+
+
+void EncodedTileCache::invalidate(const TileBitmap& damage) {
+    if (damage.columns() != columns || damage.rows() != rows) {
+        for (auto& tile : tiles) {
+            tile.clear();
+        }
+
+        return;
+    }
+
+    damage.forEachRun([&] (int row, int column, int end) {
+        for (; column < end; column++) {
+            tiles[size_t(row) * columns + column].clear();
+        }
+    });
+}
+
+
+bool EncodedTileCache::supports(int32_t encoding) {
+    if (encoding == rfbEncodingRaw) {
+        return true;
+    }
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+    if (encoding == rfbEncodingZlib) {
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+
+int EncodedTileCache::levelFor(rfbClientPtr cl, int32_t encoding) {
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+    if (encoding == rfbEncodingZlib) {
+        return clamp(cl->zlibCompressLevel, 0, 9);
+    }
+#endif
+
+    return 0;
+}
+
+
+const EncodedTileCache::Variant* EncodedTileCache::find(
+    rfbClientPtr cl, int column, int row, int32_t encoding, int level
+) const {
+    auto& variants = tiles[size_t(row) * columns + column];
+    for (auto& it : variants) {
+        if (it.encoding == encoding && it.level == level && sameFormat(it.format, cl->format)) {
+            return &it;
+        }
+    }
+
+    return nullptr;
+}
+
+
+const EncodedTileCache::Variant& EncodedTileCache::store(
+    rfbClientPtr cl, int column, int row, int32_t encoding, int level, string&& data
+) {
+    auto& variants = tiles[size_t(row) * columns + column];
+    if (variants.size() >= MAX_VARIANTS) {
+        variants.erase(variants.begin());
+    }
+
+    variants.push_back({
+        .format = cl->format,
+        .encoding = encoding,
+        .level = level,
+        .data = make_shared<const string>(std::move(data))
+    });
+
+    return variants.back();
+}
+
+
+bool EncodedTileCache::encode(
+    Encoder& encoder, rfbClientPtr cl, 
+    int column, int row, int32_t encoding, int level, string& out
+) {
+    if (encoding == rfbEncodingRaw) {
+        return encodeRaw(cl, column, row, out);
+    }
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+    if (encoding == rfbEncodingZlib) {
+        return encodeZlib(encoder, cl, column, row, level, out);
+    }
+#endif
+
+    return false;
+}
+
+
+shared_ptr<const string> EncodedTileCache::get(rfbClientPtr cl, int column, int row, int32_t encoding) {
+    if (column < 0 || column >= columns || row < 0 || row >= rows || !supports(encoding)) {
+        return nullptr;
+    }
+
+    int level = levelFor(cl, encoding);
+
+    if (auto* variant = find(cl, column, row, encoding, level)) {
+        stats.hits++;
+        return variant->data;
+    }
+
+    stats.misses++;
+
+    string data;
+    if (!encode(*encoders[0], cl, column, row, encoding, level, data)) {
+        return nullptr;
+    }
+
+    return store(cl, column, row, encoding, level, std::move(data)).data;
+}
+
+
+void EncodedTileCache::prepare(rfbClientPtr cl, const TileBitmap& wanted, int32_t encoding) {
+    if (workers.empty() || !supports(encoding) 
+        || wanted.columns() != columns || wanted.rows() != rows
+    ) {
+        return;
+    }
+
+    int level = levelFor(cl, encoding);
+
+    struct Task {
+        int column;
+        int row;
+        bool success;
+        string data;
+    };
+
+    // 按行分组。同一行的块在内存中相邻，交给同一个线程。
+
+    vector<Task> tasks;
+    vector<size_t> rowBegins;
+
+    wanted.forEachRun([&] (int row, int column, int end) {
+        for (; column < end; column++) {
+            if (find(cl, column, row, encoding, level) != nullptr) {
+                continue;
+            }
+
+            if (tasks.empty() || tasks.back().row != row) {
+                rowBegins.push_back(tasks.size());
+            }
+
+            tasks.push_back({ .column = column, .row = row, .success = false, .data = {} });
+        }
+    });
+
+    if (tasks.size() < encoders.size() * 2) {
+        return;  // 块太少，交给 get 逐块编码。
+    }
+
+    rowBegins.push_back(tasks.size());
+
+    atomic<size_t> nextRow = 0;
+
+    runOnAllThreads([&] (int index) {
+        Encoder& encoder = *encoders[index];
+
+        size_t rowIndex;
+        while ((rowIndex = nextRow.fetch_add(1)) + 1 < rowBegins.size()) {
+            for (size_t i = rowBegins[rowIndex]; i < rowBegins[rowIndex + 1]; i++) {
+                auto& task = tasks[i];
+                task.success = encode(encoder, cl, task.column, task.row, encoding, level, task.data);
+            }
+        }
+    });
+
+    for (auto& task : tasks) {
+        if (task.success) {
+            stats.misses++;
+            store(cl, task.column, task.row, encoding, level, std::move(task.data));
+        }
+    }
+}
+
+
+bool EncodedTileCache::encodeRaw(rfbClientPtr cl, int column, int row, string& out) {
+    rfbScreenInfoPtr screen = cl->screen;
+
+    int x = column * TILE_SIZE;
+    int y = row * TILE_SIZE;
+    int w = min(TILE_SIZE, width - x);
+    int h = min(TILE_SIZE, height - y);
+
+    if (w <= 0 || h <= 0 || screen->frameBuffer == nullptr) {
+        return false;
+    }
+
+    int bytesPerPixel = cl->format.bitsPerPixel / 8;
+    out.resize(size_t(w) * h * bytesPerPixel);
+
+    char* src = screen->frameBuffer 
+        + size_t(y) * screen->paddedWidthInBytes 
+        + size_t(x) * (screen->bitsPerPixel / 8);
+
+    cl->translateFn(
+        cl->translateLookupTable, &screen->serverFormat, &cl->format,
+        src, out.data(), screen->paddedWidthInBytes, w, h
+    );
+
+    return true;
+}
+
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+
+bool EncodedTileCache::encodeZlib(
+    Encoder& encoder, rfbClientPtr cl, int column, int row, int level, string& out
+) {
+    string& translated = encoder.translated;
+    if (!encodeRaw(cl, column, row, translated)) {
+        return false;
+    }
+
+    z_stream& stream = encoder.streams[level];
+
+    if (!encoder.streamInited[level]) {
+        stream = {};
+        if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+
+        encoder.streamInited[level] = true;
+    } else if (deflateReset(&stream) != Z_OK) {
+        return false;
+    }
+
+    // Z_SYNC_FLUSH 结尾额外占用几个字节。
+
+    out.resize(deflateBound(&stream, translated.size()) + 16);
+
+    stream.next_in = (Bytef*) translated.data();
+    stream.avail_in = uInt(translated.size());
+    stream.next_out = (Bytef*) out.data();
+    stream.avail_out = uInt(out.size());
+
+    int res = deflate(&stream, Z_SYNC_FLUSH);
+    if (res != Z_OK || stream.avail_in != 0) {
+        return false;
+    }
+
+    out.resize(out.size() - stream.avail_out);
+    return true;
+}
+
+#endif
+
+
+/*
+ * 编码线程。
+ */
+
+
+void EncodedTileCache::setThreads(int count) {
+    stopWorkers();
+
+    count = clamp(count, 1, 64);
+
+    encoders.resize(1);
+    for (int i = 1; i < count; i++) {
+        encoders.push_back(make_unique<Encoder>());
+        workers.emplace_back(&EncodedTileCache::workerLoop, this, i);
+    }
+}
+
+
+void EncodedTileCache::runOnAllThreads(const function<void (int index)>& job) {
+    {
+        unique_lock lock(jobs.mutex);
+        jobs.job = &job;
+        jobs.sequence++;
+        jobs.running = int(workers.size());
+    }
+    jobs.started.notify_all();
+
+    job(0);
+
+    unique_lock lock(jobs.mutex);
+    jobs.finished.wait(lock, [&] { return jobs.running == 0; });
+    jobs.job = nullptr;
+}
+
+
+void EncodedTileCache::workerLoop(int index) {
+    uint64_t sequence = 0;
+
+    while (true) {
+        const function<void (int)>* job;
+
+        {
+            unique_lock lock(jobs.mutex);
+            jobs.started.wait(lock, [&] { return jobs.stopping || jobs.sequence != sequence; });
+            if (jobs.stopping) {
+                return;
+            }
+
+            sequence = jobs.sequence;
+            job = jobs.job;
+        }
+
+        (*job)(index);
+
+        unique_lock lock(jobs.mutex);
+        if (--jobs.running == 0) {
+            jobs.finished.notify_one();
+        }
+    }
+}
+
+
+void EncodedTileCache::stopWorkers() {
+    {
+        unique_lock lock(jobs.mutex);
+        jobs.stopping = true;
+    }
+    jobs.started.notify_all();
+
+    for (auto& it : workers) {
+        it.join();
+    }
+
+    workers.clear();
+    jobs.stopping = false;
+    jobs.sequence = 0;
+}
+
+
+} // namespace vesper::vnc
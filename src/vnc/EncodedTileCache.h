@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 已编码分块缓存
+ *
+ * 创建于 2026年10月18日
+ *
+ * 多个客户端观看同一画面时，参数相同（编码、压缩级别、像素格式）的客户端共用一次编码结果。
+ * 以 64x64 块为单位缓存，块被 damage 时作废。编码开销随参数组合数增长，而不是随客户端数增长。
+ *
+ * 目前支持 Raw 和 Zlib 编码。
+ * Zlib 的每块数据都是独立的 raw deflate 流片段（从头压缩，以 Z_SYNC_FLUSH 结束），
+ * 不引用之前的数据，因此可以插入任何客户端的 zlib 流中。
+ * 各块互不依赖，一次更新中缺少的块可以分给多个线程编码，每个线程使用自己的 deflate 流。
+ */
+
+#pragma once
+
+#include "../common/TileBitmap.h"
+
+#include <rfb/rfb.h>
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+    #include <zlib.h>
+#endif
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace vesper::vnc {
+
+class EncodedTileCache {
+
+public:
+
+    static constexpr int TILE_SIZE = 64;
+    static_assert(TILE_SIZE == vesper::common::TileBitmap::TILE_SIZE);
+
+    /** 每块最多缓存几种参数组合的编码结果。 */
+    static constexpr int MAX_VARIANTS = 4;
+
+    EncodedTileCache();
+    ~EncodedTileCache();
+
+    /**
+     * 设置画面尺寸。会清空已有缓存。
+     */
+    void resize(int width, int height);
+
+    /**
+     * 作废 damage 触及的块。须在画面内容变化后、下一次 get 之前调用。
+     */
+    void invalidate(const vesper::common::TileBitmap& damage);
+
+    /**
+     * 是否支持以 encoding 为客户端编码。
+     */
+    static bool supports(int32_t encoding);
+
+    /**
+     * 设置编码线程数（含调用线程）。1 表示只在调用线程中编码。
+     */
+    void setThreads(int count);
+
+    /**
+     * 把 wanted 中按客户端参数还没有缓存的块一并编码并缓存。
+     * 缺少的块较多且有多个编码线程时，按行分给各线程并行编码。
+     */
+    void prepare(rfbClientPtr cl, const vesper::common::TileBitmap& wanted, int32_t encoding);
+
+    /**
+     * 取得块按客户端参数编码后的数据（不含矩形头）。没有缓存时现场编码并缓存。
+     *
+     * 块被作废后，已经取出的数据仍然有效，可以继续用于零拷贝发送。
+     * 
+     * @return 编码失败时返回 nullptr。
+     */
+    std::shared_ptr<const std::string> get(rfbClientPtr cl, int column, int row, int32_t encoding);
+
+public:
+
+    struct {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    } stats;
+
+protected:
+
+    struct Variant {
+        rfbPixelFormat format;
+        int32_t encoding;
+        int level;
+        std::shared_ptr<const std::string> data;
+    };
+
+    /** 编码时使用的临时状态。每个编码线程一份。 */
+    struct Encoder {
+        /** 按块翻译像素格式时使用的临时缓冲。 */
+        std::string translated;
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+        /** 每个压缩级别一个 raw deflate 流，每块编码前重置。 */
+        z_stream streams[10];
+        bool streamInited[10] = {false};
+#endif
+
+        ~Encoder();
+    };
+
+    static int levelFor(rfbClientPtr cl, int32_t encoding);
+
+    /** @return 没有缓存时返回 nullptr。 */
+    const Variant* find(rfbClientPtr cl, int column, int row, int32_t encoding, int level) const;
+
+    const Variant& store(rfbClientPtr cl, int column, int row, int32_t encoding, int level, std::string&& data);
+
+    bool encode(
+        Encoder& encoder, rfbClientPtr cl, 
+        int column, int row, int32_t encoding, int level, std::string& out
+    );
+
+    bool encodeRaw(rfbClientPtr cl, int column, int row, std::string& out);
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+    bool encodeZlib(Encoder& encoder, rfbClientPtr cl, int column, int row, int level, std::string& out);
+#endif
+
+    /**
+     * 在所有编码线程上执行 job，参数为线程序号（调用线程为 0）。全部完成后返回。
+     */
+    void runOnAllThreads(const std::function<void (int index)>& job);
+
+    void workerLoop(int index);
+
+    void stopWorkers();
+
+protected:
+
+    std::vector<std::vector<Variant>> tiles;
+    int columns = 0;
+    int rows = 0;
+    int width = 0;
+    int height = 0;
+
+    /** encoders[0] 由调用线程使用，其余依次对应 workers。 */
+    std::vector<std::unique_ptr<Encoder>> encoders;
+
+    std::vector<std::thread> workers;
+
+    struct {
+        std::mutex mutex;
+        std::condition_variable started;
+        std::condition_variable finished;
+        const std::function<void (int)>* job = nullptr;
+        uint64_t sequence = 0;
+        int running = 0;
+        bool stopping = false;
+    } jobs;
+
+};
+
+} // namespace vesper::vnc
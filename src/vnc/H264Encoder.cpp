@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * H.264 编码器
+ *
+ * 创建于 2026年10月19日
+ */
+
+#include "./H264Encoder.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace vesper::vnc {
+
+
+#ifdef VESPER_WITH_X264
+
+
+H264Encoder::~H264Encoder() {
+    if (encoder) {
+        x264_encoder_close(encoder);
+        encoder = nullptr;
+    }
+}
+
+
+bool H264Encoder::available() {
+    return true;
+}
+
+
+bool H264Encoder::open(int width, int height, int bitrateKbps, int frameRate) {
+    if (encoder || width <= 0 || height <= 0 || (width & 1) || (height & 1)) {
+        return false;
+    }
+
+    frameRate = max(frameRate, 1);
+    bitrateKbps = max(bitrateKbps, 100);
+
+    x264_param_t param;
+    if (x264_param_default_preset(&param, "ultrafast", "zerolatency") < 0) {
+        return false;
+    }
+
+    param.i_log_level = X264_LOG_ERROR;
+    param.i_width = width;
+    param.i_height = height;
+    param.i_csp = X264_CSP_I420;
+    param.i_fps_num = frameRate;
+    param.i_fps_den = 1;
+    param.i_threads = 1;
+
+    // 客户端可能随时从任意一帧开始看，每帧都带上 SPS/PPS。
+
+    param.b_repeat_headers = 1;
+    param.b_annexb = 1;
+
+    param.b_intra_refresh = 1;
+    param.i_keyint_max = frameRate * 2;
+
+    param.rc.i_rc_method = X264_RC_ABR;
+    param.rc.i_bitrate = bitrateKbps;
+    param.rc.i_vbv_max_bitrate = bitrateKbps;
+    param.rc.i_vbv_buffer_size = max(bitrateKbps / frameRate, 1);
+
+    if (x264_param_apply_profile(&param, "baseline") < 0) {
+        return false;
+    }
+
+    encoder = x264_encoder_open(&param);
+    pts = 0;
+    return encoder != nullptr;
+}
+
+
+bool H264Encoder::opened() const {
+    return encoder != nullptr;
+}
+
+
+bool H264Encoder::encode(const I420Frame& frame, string& out) {
+    out.clear();
+
+    if (encoder == nullptr) {
+        return false;
+    }
+
+    x264_picture_t in;
+    x264_picture_init(&in);
+    in.img.i_csp = X264_CSP_I420;
+    in.img.i_plane = 3;
+    in.i_pts = pts++;
+
+    for (int i = 0; i < 3; i++) {
+        in.img.plane[i] = (uint8_t*) frame.plane(i);
+        in.img.i_stride[i] = frame.stride(i);
+    }
+
+    x264_picture_t encoded;
+    x264_nal_t* nals;
+    int nalCount;
+
+    int size = x264_encoder_encode(encoder, &nals, &nalCount, &in, &encoded);
+    if (size < 0) {
+        return false;
+    }
+
+    // 同一帧的各 NAL 单元在内存中是连续的。
+
+    if (size > 0) {
+        out.assign((const char*) nals[0].p_payload, size_t(size));
+    }
+
+    return true;
+}
+
+
+#else  // VESPER_WITH_X264
+
+
+H264Encoder::~H264Encoder() {}
+
+
+bool H264Encoder::available() {
+    return false;
+}
+
+
+bool H264Encoder::open(int width, int height, int bitrateKbps, int frameRate) {
+    return false;
+}
+
+
+bool H264Encoder::opened() const {
+    return false;
+}
+
+
+bool H264Encoder::encode(const I420Frame& frame, string& out) {
+    out.clear();
+    return false;
+}
+
+
+#endif  // VESPER_WITH_X264
+
+
+} // namespace vesper::vnc
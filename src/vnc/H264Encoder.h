@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * H.264 编码器
+ *
+ * 创建于 2026年10月19日
+ *
+ * 为 Open H.264 RFB 编码（编码号 50）产生 Annex B 格式的码流，每个客户端一个。
+ * 使用 libx264，构建时需开启 VESPER_WITH_X264。没有开启时 available() 返回 false。
+ *
+ * 不使用周期性关键帧，改用帧内刷新，把 I 宏块分散到连续多帧中，避免码率尖峰。
+ * 只在画面有变化时编码。
+ */
+
+#pragma once
+
+#include "./I420Frame.h"
+
+#include <string>
+#include <cstdint>
+
+#ifdef VESPER_WITH_X264
+extern "C" {
+    #include <x264.h>
+}
+#endif
+
+namespace vesper::vnc {
+
+class H264Encoder {
+
+public:
+
+    /** Open H.264 的编码号。 */
+    static constexpr int32_t ENCODING = 50;
+
+    /** 矩形数据头中的标志：解码这一帧之前，重置该矩形的解码器。 */
+    static constexpr uint32_t FLAG_RESET_CONTEXT = 1;
+
+    H264Encoder() = default;
+    H264Encoder(const H264Encoder&) = delete;
+    H264Encoder& operator = (const H264Encoder&) = delete;
+    ~H264Encoder();
+
+    /**
+     * 构建时是否带有 H.264 编码器。
+     */
+    static bool available();
+
+    /**
+     * @param bitrateKbps 平均码率。
+     * @param frameRate 每秒最多编码几帧，用于码率控制和帧内刷新周期。
+     */
+    bool open(int width, int height, int bitrateKbps, int frameRate);
+
+    bool opened() const;
+
+    /**
+     * 编码一帧。尺寸须与 open 时一致。
+     *
+     * @param out 这一帧的所有 NAL 单元。编码器暂时没有输出时为空。
+     */
+    bool encode(const I420Frame& frame, std::string& out);
+
+protected:
+
+#ifdef VESPER_WITH_X264
+    x264_t* encoder = nullptr;
+    int64_t pts = 0;
+#endif
+
+};
+
+} // namespace vesper::vnc
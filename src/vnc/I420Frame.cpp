@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * I420 画面
+ *
+ * 创建于 2026年10月19日
+ */
+
+#include "./I420Frame.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace vesper::common;
+
+namespace vesper::vnc {
+
+
+void I420Frame::resize(int srcWidth, int srcHeight) {
+    this->srcWidth = max(srcWidth, 0);
+    frameWidth = max(srcWidth, 0) & ~1;
+    frameHeight = max(srcHeight, 0) & ~1;
+
+    size_t lumaSize = size_t(frameWidth) * frameHeight;
+    planes[0].assign(lumaSize, 16);
+    planes[1].assign(lumaSize / 4, 128);
+    planes[2].assign(lumaSize / 4, 128);
+}
+
+
+static inline uint8_t luma(int r, int g, int b) {
+    return uint8_t(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+
+void I420Frame::update(const uint32_t* pixels, const TileBitmap& damage) {
+    const int tileSize = TileBitmap::TILE_SIZE;
+    static_assert(tileSize % 2 == 0);
+
+    if (frameWidth == 0 || frameHeight == 0) {
+        return;
+    }
+
+    uint8_t* yPlane = planes[0].data();
+    uint8_t* uPlane = planes[1].data();
+    uint8_t* vPlane = planes[2].data();
+    const int chromaStride = frameWidth / 2;
+
+    damage.forEachRun([&] (int row, int column, int end) {
+        int x1 = column * tileSize;
+        int x2 = min(end * tileSize, frameWidth);
+        int y1 = row * tileSize;
+        int y2 = min((row + 1) * tileSize, frameHeight);
+
+        // 每次处理 2x2 像素：四个亮度采样，色度取四个像素的平均值。
+
+        for (int y = y1; y < y2; y += 2) {
+            const uint32_t* src0 = pixels + size_t(y) * srcWidth;
+            const uint32_t* src1 = src0 + srcWidth;
+            uint8_t* dst0 = yPlane + size_t(y) * frameWidth;
+            uint8_t* dst1 = dst0 + frameWidth;
+            uint8_t* u = uPlane + size_t(y / 2) * chromaStride;
+            uint8_t* v = vPlane + size_t(y / 2) * chromaStride;
+
+            for (int x = x1; x < x2; x += 2) {
+                uint32_t p[4] = { src0[x], src0[x + 1], src1[x], src1[x + 1] };
+
+                int rSum = 0;
+                int gSum = 0;
+                int bSum = 0;
+
+                for (int i = 0; i < 4; i++) {
+                    int r = (p[i] >> 16) & 0xFF;
+                    int g = (p[i] >> 8) & 0xFF;
+                    int b = p[i] & 0xFF;
+
+                    (i < 2 ? dst0 : dst1)[x + (i & 1)] = luma(r, g, b);
+
+                    rSum += r;
+                    gSum += g;
+                    bSum += b;
+                }
+
+                int r = (rSum + 2) >> 2;
+                int g = (gSum + 2) >> 2;
+                int b = (bSum + 2) >> 2;
+
+                u[x / 2] = uint8_t(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                v[x / 2] = uint8_t(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            }
+        }
+    });
+}
+
+
+} // namespace vesper::vnc
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * I420 画面
+ *
+ * 创建于 2026年10月19日
+ *
+ * 把 32 位 BGRX 画面转换为 I420（BT.601 有限范围），供视频编码器使用。
+ * 常驻一份，只按 damage 转换变化的块。
+ */
+
+#pragma once
+
+#include "../common/TileBitmap.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace vesper::vnc {
+
+class I420Frame {
+
+public:
+
+    /**
+     * 设置源画面尺寸。宽高向下取偶数（色度平面每 2x2 像素一个采样）。
+     * 会清空已有内容。
+     */
+    void resize(int srcWidth, int srcHeight);
+
+    int width() const { return frameWidth; }
+    int height() const { return frameHeight; }
+
+    /**
+     * 转换 damage 触及的块。
+     *
+     * @param pixels 源画面。32 位像素，每行 srcWidth 个像素，紧密排列。
+     */
+    void update(const uint32_t* pixels, const vesper::common::TileBitmap& damage);
+
+    /** @param index 0 为 Y，1 为 U，2 为 V。 */
+    const uint8_t* plane(int index) const { return planes[index].data(); }
+
+    int stride(int index) const { return index == 0 ? frameWidth : frameWidth / 2; }
+
+protected:
+
+    std::vector<uint8_t> planes[3];
+    int srcWidth = 0;
+    int frameWidth = 0;
+    int frameHeight = 0;
+
+};
+
+} // namespace vesper::vnc
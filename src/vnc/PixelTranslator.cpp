@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 像素格式转换
+ *
+ * 创建于 2026年10月19日
+ *
+ * libvncserver 的查表把每个分量换算为 (c * max + 127) / 255。
+ * 这里在 16 位通道中做同样的运算，除以 255 换成移位，结果逐位一致。
+ */
+
+#include "./PixelTranslator.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace vesper::vnc {
+
+
+namespace {
+
+struct Format {
+    int bytes;
+    bool bigEndian;
+    int redMax;
+    int redShift;
+    int greenMax;
+    int greenShift;
+    int blueMax;
+    int blueShift;
+};
+
+} // namespace
+
+
+/*
+ * 支持的格式。
+ */
+
+/** 服务端格式。 */
+static constexpr Format BGRX = { 4, false, 255, 16, 255, 8, 255, 0 };
+
+static constexpr Format BGRX_BE = { 4, true, 255, 16, 255, 8, 255, 0 };
+static constexpr Format RGBX = { 4, false, 255, 0, 255, 8, 255, 16 };
+static constexpr Format RGBX_BE = { 4, true, 255, 0, 255, 8, 255, 16 };
+static constexpr Format RGB565 = { 2, false, 31, 11, 63, 5, 31, 0 };
+static constexpr Format RGB565_BE = { 2, true, 31, 11, 63, 5, 31, 0 };
+static constexpr Format BGR565 = { 2, false, 31, 0, 63, 5, 31, 11 };
+static constexpr Format RGB555 = { 2, false, 31, 10, 31, 5, 31, 0 };
+static constexpr Format RGB555_BE = { 2, true, 31, 10, 31, 5, 31, 0 };
+static constexpr Format BGR233 = { 1, false, 7, 0, 7, 3, 3, 6 };
+static constexpr Format RGB332 = { 1, false, 7, 5, 7, 2, 3, 0 };
+
+
+template<int MAX>
+static inline uint32_t scale(uint32_t c) {
+    return (c * MAX + 127) / 255;
+}
+
+
+template<Format IN, Format OUT>
+static inline uint32_t convert(uint32_t pixel) {
+    uint32_t r = scale<OUT.redMax>((pixel >> IN.redShift) & 0xFF);
+    uint32_t g = scale<OUT.greenMax>((pixel >> IN.greenShift) & 0xFF);
+    uint32_t b = scale<OUT.blueMax>((pixel >> IN.blueShift) & 0xFF);
+    return (r << OUT.redShift) | (g << OUT.greenShift) | (b << OUT.blueShift);
+}
+
+
+template<Format OUT>
+static inline void store(char* dst, uint32_t value) {
+    if constexpr (OUT.bytes == 1) {
+        *(uint8_t*) dst = uint8_t(value);
+    } else if constexpr (OUT.bytes == 2) {
+        uint16_t v = OUT.bigEndian ? __builtin_bswap16(uint16_t(value)) : uint16_t(value);
+        memcpy(dst, &v, sizeof(v));
+    } else {
+        uint32_t v = OUT.bigEndian ? __builtin_bswap32(value) : value;
+        memcpy(dst, &v, sizeof(v));
+    }
+}
+
+
+#if defined(__SSE2__)
+
+
+/** 取出 8 个像素的一个分量，放在 16 位通道中。 */
+static inline __m128i channel(__m128i low, __m128i high, int shift) {
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    low = _mm_and_si128(_mm_srli_epi32(low, shift), mask);
+    high = _mm_and_si128(_mm_srli_epi32(high, shift), mask);
+    return _mm_packs_epi32(low, high);
+}
+
+
+/** x / 255 == (x + 1 + (x >> 8)) >> 8，对 x <= 65534 成立。 */
+template<int MAX>
+static inline __m128i scale(__m128i c) {
+    if constexpr (MAX == 255) {
+        return c;
+    } else {
+        __m128i x = _mm_add_epi16(_mm_mullo_epi16(c, _mm_set1_epi16(MAX)), _mm_set1_epi16(127));
+        x = _mm_add_epi16(x, _mm_add_epi16(_mm_srli_epi16(x, 8), _mm_set1_epi16(1)));
+        return _mm_srli_epi16(x, 8);
+    }
+}
+
+
+static inline __m128i byteSwap16(__m128i v) {
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+
+static inline __m128i byteSwap32(__m128i v) {
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return byteSwap16(v);
+}
+
+
+/** 转换 8 个像素。 */
+template<Format IN, Format OUT>
+static inline void convert8(const char* src, char* dst) {
+    __m128i low = _mm_loadu_si128((const __m128i*) src);
+    __m128i high = _mm_loadu_si128((const __m128i*) (src + 16));
+
+    __m128i r = scale<OUT.redMax>(channel(low, high, IN.redShift));
+    __m128i g = scale<OUT.greenMax>(channel(low, high, IN.greenShift));
+    __m128i b = scale<OUT.blueMax>(channel(low, high, IN.blueShift));
+
+    if constexpr (OUT.bytes == 4) {
+        const __m128i zero = _mm_setzero_si128();
+
+        __m128i out[2];
+        for (int i = 0; i < 2; i++) {
+            __m128i r32 = i ? _mm_unpackhi_epi16(r, zero) : _mm_unpacklo_epi16(r, zero);
+            __m128i g32 = i ? _mm_unpackhi_epi16(g, zero) : _mm_unpacklo_epi16(g, zero);
+            __m128i b32 = i ? _mm_unpackhi_epi16(b, zero) : _mm_unpacklo_epi16(b, zero);
+
+            out[i] = _mm_or_si128(
+                _mm_or_si128(_mm_slli_epi32(r32, OUT.redShift), _mm_slli_epi32(g32, OUT.greenShift)),
+                _mm_slli_epi32(b32, OUT.blueShift)
+            );
+
+            if constexpr (OUT.bigEndian) {
+                out[i] = byteSwap32(out[i]);
+            }
+        }
+
+        _mm_storeu_si128((__m128i*) dst, out[0]);
+        _mm_storeu_si128((__m128i*) (dst + 16), out[1]);
+    } else {
+        __m128i out = _mm_or_si128(
+            _mm_or_si128(_mm_slli_epi16(r, OUT.redShift), _mm_slli_epi16(g, OUT.greenShift)),
+            _mm_slli_epi16(b, OUT.blueShift)
+        );
+
+        if constexpr (OUT.bytes == 1) {
+            _mm_storel_epi64((__m128i*) dst, _mm_packus_epi16(out, out));
+        } else {
+            if constexpr (OUT.bigEndian) {
+                out = byteSwap16(out);
+            }
+
+            _mm_storeu_si128((__m128i*) dst, out);
+        }
+    }
+}
+
+
+#endif  // defined(__SSE2__)
+
+
+/**
+ * 符合 rfbTranslateFnType。输出紧密排列，每行 width 个像素。
+ */
+template<Format IN, Format OUT>
+static void translate(
+    char* table, rfbPixelFormat* in, rfbPixelFormat* out,
+    char* iptr, char* optr, int bytesBetweenInputLines, int width, int height
+) {
+    static_assert(IN.bytes == 4 && IN.redMax == 255 && IN.greenMax == 255 && IN.blueMax == 255);
+
+    for (int y = 0; y < height; y++) {
+        const char* src = iptr + size_t(y) * bytesBetweenInputLines;
+        int x = 0;
+
+#if defined(__SSE2__)
+        for (; x + 8 <= width; x += 8) {
+            convert8<IN, OUT>(src + x * 4, optr + x * OUT.bytes);
+        }
+#endif
+
+        for (; x < width; x++) {
+            uint32_t pixel;
+            memcpy(&pixel, src + x * 4, sizeof(pixel));
+            store<OUT>(optr + x * OUT.bytes, convert<IN, OUT>(pixel));
+        }
+
+        optr += size_t(width) * OUT.bytes;
+    }
+}
+
+
+static bool matches(const Format& format, const rfbPixelFormat& pf) {
+    return pf.trueColour
+        && pf.bitsPerPixel == format.bytes * 8
+        && (format.bytes == 1 || bool(pf.bigEndian) == format.bigEndian)
+        && pf.redMax == format.redMax
+        && pf.greenMax == format.greenMax
+        && pf.blueMax == format.blueMax
+        && pf.redShift == format.redShift
+        && pf.greenShift == format.greenShift
+        && pf.blueShift == format.blueShift;
+}
+
+
+rfbTranslateFnType PixelTranslator::find(const rfbPixelFormat& in, const rfbPixelFormat& out) {
+    struct Entry {
+        Format format;
+        rfbTranslateFnType fn;
+    };
+
+    static const Entry translators[] = {
+        { RGB565, translate<BGRX, RGB565> },
+        { RGB565_BE, translate<BGRX, RGB565_BE> },
+        { BGR565, translate<BGRX, BGR565> },
+        { RGB555, translate<BGRX, RGB555> },
+        { RGB555_BE, translate<BGRX, RGB555_BE> },
+        { BGR233, translate<BGRX, BGR233> },
+        { RGB332, translate<BGRX, RGB332> },
+        { RGBX, translate<BGRX, RGBX> },
+        { RGBX_BE, translate<BGRX, RGBX_BE> },
+        { BGRX_BE, translate<BGRX, BGRX_BE> },
+    };
+
+    if (!matches(BGRX, in)) {
+        return nullptr;
+    }
+
+    for (auto& it : translators) {
+        if (matches(it.format, out)) {
+            return it.fn;
+        }
+    }
+
+    return nullptr;
+}
+
+
+} // namespace vesper::vnc
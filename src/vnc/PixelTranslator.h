@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 像素格式转换
+ *
+ * 创建于 2026年10月19日
+ *
+ * libvncserver 把服务端像素转换为客户端格式时，逐像素查表。
+ * 这里为常见的客户端格式（RGB565、RGB555、BGR233 等）提供按格式特化的转换函数，
+ * 用 SSE2 一次转换 8 个像素。结果与 libvncserver 查表完全相同。
+ */
+
+#pragma once
+
+#include <rfb/rfb.h>
+
+namespace vesper::vnc {
+
+class PixelTranslator {
+
+public:
+
+    /**
+     * 找到从 in 转换到 out 的特化函数。
+     *
+     * @param in 只支持 32 位、红绿蓝各 8 位、小端的服务端格式。
+     * @return 没有对应的特化函数时返回 nullptr。
+     */
+    static rfbTranslateFnType find(const rfbPixelFormat& in, const rfbPixelFormat& out);
+
+};
+
+} // namespace vesper::vnc
@@ -7,8 +7,19 @@
  */
 
 #include "./Server.h"
+#include "./ClientData.h"
+#include "./PixelTranslator.h"
+#include "../utils/XtScancodeToEvdevScancode.h"
 #include <xkbcommon/xkbcommon.h>
 
+#include <thread>
+#include <chrono>
+#include <mutex>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+
 using namespace std;
 
 using namespace vesper::common;
@@ -22,16 +33,359 @@ Server::~Server() {
 }
 
 
-static void markDamagedAreas(rfbScreenInfoPtr screen, const pixman::Region32& damage) {
+static void markDamagedAreas(rfbScreenInfoPtr screen, const TileBitmap& damage) {
+    const int tileSize = TileBitmap::TILE_SIZE;
+
+    damage.forEachRun([&] (int row, int column, int end) {
+        rfbMarkRectAsModified(
+            screen, 
+            column * tileSize, 
+            row * tileSize, 
+            min(end * tileSize, screen->width), 
+            min((row + 1) * tileSize, screen->height)
+        );
+    });
+}
+
+
+static inline int64_t currTimeNsec() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+
+static void sraRgnToRegion32(sraRegionPtr src, pixman::Region32& dst) {
+    dst.clear();
+
+    sraRectangleIterator* iterator = sraRgnGetIterator(src);
+    sraRect rect;
+    while (sraRgnIteratorNext(iterator, &rect)) {
+        dst += (pixman_box32_t) {
+            .x1 = rect.x1, .y1 = rect.y1, .x2 = rect.x2, .y2 = rect.y2
+        };
+    }
+    sraRgnReleaseIterator(iterator);
+}
+
+
+static sraRegionPtr region32ToSraRgn(const pixman::Region32& src) {
+    sraRegionPtr dst = sraRgnCreate();
+
     int nRects;
-    const pixman_box32_t* rects = damage.rectangles(&nRects);
+    const pixman_box32_t* rects = src.rectangles(&nRects);
     for (int i = 0; i < nRects; i++) {
         auto& it = rects[i];
-        rfbMarkRectAsModified(screen, it.x1, it.y1, it.x2, it.y2);
+        sraRegionPtr rect = sraRgnCreateRect(it.x1, it.y1, it.x2, it.y2);
+        sraRgnOr(dst, rect);
+        sraRgnDestroy(rect);
+    }
+
+    return dst;
+}
+
+
+/**
+ * 持有客户端的 updateMutex。
+ * 多线程模式下，libvncserver 的客户端线程也会读写 modifiedRegion 和 requestedRegion。
+ */
+class ClientUpdateLock {
+public:
+    explicit ClientUpdateLock(rfbClientPtr cl) : cl(cl) {
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+        LOCK(cl->updateMutex);
+#endif
+    }
+
+    ~ClientUpdateLock() {
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+        UNLOCK(cl->updateMutex);
+#endif
+    }
+
+protected:
+    rfbClientPtr cl;
+};
+
+
+/**
+ * 发送只含 QEMU Extended Key Event 伪矩形的画面更新，告知客户端可以发送扩展按键事件。
+ * 多线程模式下，客户端线程可能正在发送画面，须持有 sendMutex。
+ */
+static void sendExtendedKeyEventAck(rfbClientPtr cl) {
+    char buf[sz_rfbFramebufferUpdateMsg + sz_rfbFramebufferUpdateRectHeader];
+
+    rfbFramebufferUpdateMsg msg;
+    msg.type = rfbFramebufferUpdate;
+    msg.pad = 0;
+    msg.nRects = Swap16IfLE(uint16_t(1));
+    memcpy(buf, &msg, sz_rfbFramebufferUpdateMsg);
+
+    rfbFramebufferUpdateRectHeader header;
+    header.r.x = header.r.y = header.r.w = header.r.h = 0;
+    header.encoding = Swap32IfLE(uint32_t(rfbEncodingQemuExtendedKeyEvent));
+    memcpy(buf + sz_rfbFramebufferUpdateMsg, &header, sz_rfbFramebufferUpdateRectHeader);
+
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+    LOCK(cl->sendMutex);
+#endif
+    if (rfbWriteExact(cl, buf, int(sizeof(buf))) < 0) {
+        rfbLogPerror("sendExtendedKeyEventAck: write");
+        rfbCloseClient(cl);
     }
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+    UNLOCK(cl->sendMutex);
+#endif
 }
 
 
+/**
+ * 是否有客户端正在等待画面更新。
+ */
+static bool clientsAwaitingUpdate(rfbScreenInfoPtr screen) {
+    bool res = false;
+
+    rfbClientIteratorPtr iterator = rfbGetClientIterator(screen);
+    rfbClientPtr cl;
+    while ((cl = rfbClientIteratorNext(iterator)) != nullptr) {
+        ClientUpdateLock lock(cl);
+        if (cl->state == rfbClientRec::RFB_NORMAL && !sraRgnEmpty(cl->requestedRegion)) {
+            res = true;
+            break;
+        }
+    }
+    rfbReleaseClientIterator(iterator);
+
+    return res;
+}
+
+
+/**
+ * 客户端能否使用分块缓存。
+ * 客户端不支持光标形状更新时，libvncserver 会把光标画进发送的像素里，与哈希对不上。
+ * 缓存指令与其余矩形放在同一条更新里，矩形数事先无法确定，客户端须支持 LastRect。
+ */
+static bool tileCacheUsable(rfbClientPtr cl) {
+    auto* data = (ClientData*) cl->clientData;
+    return data != nullptr 
+        && data->tileCache.capacity() > 0
+        && cl->state == rfbClientRec::RFB_NORMAL
+        && cl->enableCursorShapeUpdates
+        && cl->enableLastRectEncoding
+        && cl->scaledScreen == cl->screen;
+}
+
+
+static bool samePixelFormat(const rfbPixelFormat& a, const rfbPixelFormat& b) {
+    return a.bitsPerPixel == b.bitsPerPixel
+        && a.depth == b.depth
+        && a.bigEndian == b.bigEndian
+        && a.trueColour == b.trueColour
+        && a.redMax == b.redMax
+        && a.greenMax == b.greenMax
+        && a.blueMax == b.blueMax
+        && a.redShift == b.redShift
+        && a.greenShift == b.greenShift
+        && a.blueShift == b.blueShift;
+}
+
+
+typedef rfbBool (*RectEncoder)(rfbClientPtr cl, int x, int y, int w, int h);
+
+/**
+ * libvncserver 中按 encoding 编码并写入一个矩形的函数。
+ *
+ * @return 不支持的编码返回 nullptr。
+ */
+static RectEncoder rectEncoderFor(int32_t encoding) {
+    switch (encoding) {
+        case rfbEncodingRaw:
+            return rfbSendRectEncodingRaw;
+        case rfbEncodingRRE:
+            return rfbSendRectEncodingRRE;
+        case rfbEncodingCoRRE:
+            return rfbSendRectEncodingCoRRE;
+        case rfbEncodingHextile:
+            return rfbSendRectEncodingHextile;
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+        case rfbEncodingZlib:
+            return rfbSendRectEncodingZlib;
+        case rfbEncodingZRLE:
+        case rfbEncodingZYWRLE:
+            return rfbSendRectEncodingZRLE;
+#ifdef LIBVNCSERVER_HAVE_LIBJPEG
+        case rfbEncodingTight:
+            return rfbSendRectEncodingTight;
+#endif
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+
+static pixman_box32_t tileBox(rfbScreenInfoPtr screen, int column, int row) {
+    const int tileSize = TileBitmap::TILE_SIZE;
+
+    return {
+        .x1 = column * tileSize,
+        .y1 = row * tileSize,
+        .x2 = min((column + 1) * tileSize, screen->width),
+        .y2 = min((row + 1) * tileSize, screen->height)
+    };
+}
+
+
+struct TileCacheRect {
+    pixman_box32_t box;
+    int slot;
+};
+
+
+/**
+ * 把分块缓存的矩形追加到客户端正在组装的 FramebufferUpdate（cl->updateBuf）中。
+ * 
+ * @return 写入失败时 libvncserver 已关闭客户端，返回 false。
+ */
+static bool appendTileCacheRects(
+    rfbClientPtr cl, int32_t encoding, const vector<TileCacheRect>& rects
+) {
+    const int RECT_SIZE = sz_rfbFramebufferUpdateRectHeader + sizeof(uint32_t);
+
+    for (auto& it : rects) {
+        if (cl->ublen + RECT_SIZE > UPDATE_BUF_SIZE && !rfbSendUpdateBuf(cl)) {
+            return false;
+        }
+
+        rfbFramebufferUpdateRectHeader header;
+        header.r.x = Swap16IfLE(uint16_t(it.box.x1));
+        header.r.y = Swap16IfLE(uint16_t(it.box.y1));
+        header.r.w = Swap16IfLE(uint16_t(it.box.x2 - it.box.x1));
+        header.r.h = Swap16IfLE(uint16_t(it.box.y2 - it.box.y1));
+        header.encoding = Swap32IfLE(uint32_t(encoding));
+        memcpy(cl->updateBuf + cl->ublen, &header, sz_rfbFramebufferUpdateRectHeader);
+        cl->ublen += sz_rfbFramebufferUpdateRectHeader;
+
+        uint32_t slot = Swap32IfLE(uint32_t(it.slot));
+        memcpy(cl->updateBuf + cl->ublen, &slot, sizeof(slot));
+        cl->ublen += sizeof(slot);
+    }
+
+    return true;
+}
+
+
+/**
+ * 客户端在启用 H.264 之后又发送了 SetEncodings，且其中没有 Open H.264 时，停止使用 H.264。
+ * libvncserver 在处理编码列表之前就记下了这条消息，所以计数与启用时不同即说明如此。
+ */
+static void expireH264Request(rfbClientPtr cl) {
+    auto* data = (ClientData*) cl->clientData;
+    if (data == nullptr || !data->h264.requested) {
+        return;
+    }
+
+    if (rfbStatGetMessageCountRcvd(cl, rfbSetEncodings) == data->h264.setEncodingsCount) {
+        return;
+    }
+
+    data->h264.requested = false;
+    data->h264.encoder.reset();
+    LOG_INFO("h264 disabled for client ", cl->host, ".");
+}
+
+
+/**
+ * 能否由 vesper 以 Open H.264 编码为客户端发送更新。
+ * 画面尺寸变化等待发送时，交还给 libvncserver。
+ */
+static bool h264UpdateUsable(rfbClientPtr cl) {
+    auto* data = (ClientData*) cl->clientData;
+    return data != nullptr
+        && data->h264.requested
+        && cl->state == rfbClientRec::RFB_NORMAL
+        && cl->scaledScreen == cl->screen
+        && cl->enableCursorShapeUpdates
+        && !cl->newFBSizePending
+        && sraRgnEmpty(cl->copyRegion);
+}
+
+
+/**
+ * 能否由 vesper 以共用的编码结果为客户端发送更新。
+ * 有 libvncserver 才能处理的附带内容（光标、尺寸变化、CopyRect 等）待发送时，交还给 libvncserver。
+ */
+/**
+ * @param sharedEncoding 未开启共享编码时，只接管 Zlib 客户端（为了并行压缩）。
+ */
+static bool sharedUpdateUsable(rfbClientPtr cl, bool sharedEncoding) {
+    bool encodingUsable = sharedEncoding 
+        ? EncodedTileCache::supports(cl->preferredEncoding)
+        : cl->preferredEncoding == rfbEncodingZlib && EncodedTileCache::supports(rfbEncodingZlib);
+
+    return cl->clientData != nullptr
+        && cl->state == rfbClientRec::RFB_NORMAL
+        && encodingUsable
+        && !((ClientData*) cl->clientData)->h264.requested
+        && cl->scaledScreen == cl->screen
+        && cl->enableCursorShapeUpdates
+        && !cl->cursorWasChanged
+        && !cl->cursorWasMoved
+        && !cl->newFBSizePending
+        && !cl->enableSupportedMessages
+        && !cl->enableSupportedEncodings
+        && !cl->enableServerIdentity
+        && sraRgnEmpty(cl->copyRegion)
+        && !sraRgnEmpty(cl->requestedRegion);
+}
+
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+
+/**
+ * 让客户端自己的 zlib 流（libvncserver 维护）做一次 Z_FULL_FLUSH，
+ * 使之后 libvncserver 压缩的数据不再引用插入共享数据之前的内容。
+ * 
+ * @param out 产生的字节，须先于共享数据发给客户端。流尚未开始时包含 zlib 头。
+ */
+static bool flushClientZlibStream(rfbClientPtr cl, string& out) {
+    if (!cl->compStreamInited) {
+        cl->compStream.zalloc = Z_NULL;
+        cl->compStream.zfree = Z_NULL;
+        cl->compStream.opaque = Z_NULL;
+
+        int res = deflateInit2(
+            &cl->compStream, cl->zlibCompressLevel, Z_DEFLATED, 
+            MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY
+        );
+
+        if (res != Z_OK) {
+            return false;
+        }
+
+        cl->compStreamInited = TRUE;
+    }
+
+    char buf[64];
+    cl->compStream.next_in = Z_NULL;
+    cl->compStream.avail_in = 0;
+    cl->compStream.next_out = (Bytef*) buf;
+    cl->compStream.avail_out = sizeof(buf);
+
+    // 上一次已经是 Z_FULL_FLUSH 时返回 Z_BUF_ERROR，没有输出，也不需要输出。
+
+    int res = deflate(&cl->compStream, Z_FULL_FLUSH);
+    if (res != Z_OK && res != Z_BUF_ERROR) {
+        return false;
+    }
+
+    out.assign(buf, sizeof(buf) - cl->compStream.avail_out);
+    return true;
+}
+
+#endif
+
+
 static void clearRunOptionsResult(Server::RunOptions& options) {
     auto& res = options.result;
 
@@ -68,6 +422,37 @@ int Server::run() {
     memset(framebufferFallback, 0, framebufSize);
 
     rfbServer->frameBuffer = nullptr;
+
+    // 多线程模式下，客户端线程随时可能读取帧缓冲，不能直接使用租来的画面。
+
+    if (opts.net.threadedClients) {
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+        this->framebufferCopy = new (nothrow) char [framebufSize];
+        if (this->framebufferCopy == nullptr) {
+            const char* err = "failed to allocate framebuffer copy!";
+            LOG_ERROR(err);
+            opts.result.msg = err;
+            opts.result.code = -1;
+            this->clear();
+            return opts.result.code;
+        }
+        this->framebufferCopyValid = false;
+
+        // 这些功能在主循环里直接向客户端写数据，会与客户端线程冲突。
+
+        if (opts.encoding.tileCacheSize > 0 || tileEncodingEnabled() || opts.encoding.h264.enabled) {
+            LOG_WARN("tile cache, shared encoding, parallel encoding and h264 are not available with threaded clients.");
+            opts.encoding.tileCacheSize = 0;
+            opts.encoding.sharedEncoding = false;
+            opts.encoding.encodeThreads = 1;
+            opts.encoding.h264.enabled = false;
+            opts.net.zeroCopy = false;
+        }
+#else
+        LOG_WARN("libvncserver was built without pthread. threaded clients disabled.");
+        opts.net.threadedClients = false;
+#endif
+    }
     
     if (opts.net.port >= 0) {
         rfbServer->port = opts.net.port;
@@ -96,21 +481,278 @@ int Server::run() {
         rfbServer->authPasswdData = (void*) opts.auth.libvncserverPasswdFile.c_str();
     }
 
+    // 多线程模式下，各客户端的输入线程都会调用这里。逐个交给桌面，保证输入的先后顺序。
+
     rfbServer->ptrAddEvent = [] (int buttonMask, int x, int y, rfbClientPtr cl) {
         auto* p = (Server*) cl->screen->screenData;
+        lock_guard lock(p->inputMutex);
         p->mouseEventHandler(buttonMask, x, y, cl);
     };
     
     rfbServer->kbdAddEvent = [] (rfbBool down, rfbKeySym keySym, rfbClientPtr cl) {
         auto* p = (Server*) cl->screen->screenData;
+        lock_guard lock(p->inputMutex);
         p->keyboardEventHandler(down, keySym, cl);
     };
 
+    rfbServer->newClientHook = [] (rfbClientPtr cl) {
+        auto* server = (Server*) cl->screen->screenData;
+
+        if (server->acceptWebSocketClient(cl) == false) {
+            return RFB_CLIENT_REFUSE;
+        }
+
+        cl->clientData = new (nothrow) ClientData;
+
+        if (cl->clientData && server->zeroCopyUsable(cl)) {
+            ((ClientData*) cl->clientData)->zeroCopy.enable(cl->sock);
+        }
+        cl->clientGoneHook = [] (rfbClientPtr cl) {
+            delete (ClientData*) cl->clientData;
+            cl->clientData = nullptr;
+        };
+
+        return RFB_CLIENT_ACCEPT;
+    };
+
+    // 常见的低色深客户端格式换用特化的转换函数。其余格式仍由 libvncserver 查表转换。
+
+    rfbServer->setTranslateFunction = [] (rfbClientPtr cl) -> rfbBool {
+        if (!rfbSetTranslateFunction(cl)) {
+            return FALSE;
+        }
+
+        auto translateFn = PixelTranslator::find(cl->screen->serverFormat, cl->format);
+        if (translateFn) {
+            cl->translateFn = translateFn;
+        }
+
+        return TRUE;
+    };
+
+    // 记录每次更新实际以什么质量发送了哪些区域，供无损重发使用。
+
+    rfbServer->displayHook = [] (rfbClientPtr cl) {
+        auto* data = (ClientData*) cl->clientData;
+        if (data == nullptr) {
+            return;
+        }
+
+        ClientUpdateLock updateLock(cl);
+        lock_guard dataLock(data->mutex);
+
+        pixman::Region32 requested;
+        sraRgnToRegion32(cl->requestedRegion, requested);
+        sraRgnToRegion32(cl->modifiedRegion, data->sending.region);
+        data->sending.region.intersectWith(requested);
+
+#ifdef LIBVNCSERVER_HAVE_LIBJPEG
+        data->sending.lossy = cl->preferredEncoding == rfbEncodingTight 
+            && cl->turboQualityLevel >= 0;
+#else
+        data->sending.lossy = false;
+#endif
+    };
+
+    rfbServer->displayFinishedHook = [] (rfbClientPtr cl, int result) {
+        auto* data = (ClientData*) cl->clientData;
+        if (data == nullptr || !result) {
+            return;
+        }
+
+        lock_guard dataLock(data->mutex);
+
+        if (data->sending.lossy) {
+            data->lossyRegion += data->sending.region;
+            data->lastLossyNsec = currTimeNsec();
+        } else {
+            data->lossyRegion -= data->sending.region;
+        }
+
+        if (!data->sending.lossy) {
+            data->refining = false;  // 一次无损更新就是一轮重发。
+        }
+
+        data->sending.region.clear();
+    };
+
+    // WebSocket 与 RFB 共用同一个端口，由 libvncserver 根据客户端发来的第一个报文区分。
+
+    auto& websocket = opts.net.websocket;
+    if (websocket.enabled) {
+#ifdef LIBVNCSERVER_WITH_WEBSOCKETS
+        if (!websocket.certFile.empty() && !websocket.keyFile.empty()) {
+            rfbServer->sslcertfile = (char*) websocket.certFile.c_str();
+            rfbServer->sslkeyfile = (char*) websocket.keyFile.c_str();
+        } else if (!websocket.certFile.empty() || !websocket.keyFile.empty()) {
+            LOG_WARN("websocket: both cert and key are required for wss. using plain ws.");
+        }
+#else
+        LOG_WARN("websocket: libvncserver was built without websocket support.");
+#endif
+    }
+
+    // 分块缓存只对声明了 TileCache::PSEUDO_ENCODING 的客户端启用。
+
+    if (opts.encoding.tileCacheSize > 0 && !tileCacheExtensionRegistered) {
+        static int pseudoEncodings[] = { TileCache::PSEUDO_ENCODING, 0 };
+
+        tileCacheExtension = {};
+        tileCacheExtension.pseudoEncodings = pseudoEncodings;
+        tileCacheExtension.enablePseudoEncoding = [] (
+            rfbClientPtr cl, void** extData, int encoding
+        ) -> rfbBool {
+            auto* server = (Server*) cl->screen->screenData;
+            auto* data = (ClientData*) cl->clientData;
+            if (data == nullptr || encoding != TileCache::PSEUDO_ENCODING) {
+                return FALSE;
+            }
+
+            if (data->tileCache.capacity() == 0) {
+                data->tileCache.setCapacity(server->options.encoding.tileCacheSize);
+                LOG_INFO("tile cache enabled for client ", cl->host, ".");
+            }
+
+            return TRUE;
+        };
+
+        rfbRegisterProtocolExtension(&tileCacheExtension);
+        tileCacheExtensionRegistered = true;
+    }
+
+    // Open H.264 对 libvncserver 来说是未知编码，同样借助扩展得知客户端是否支持。
+
+    if (opts.encoding.h264.enabled && !H264Encoder::available()) {
+        LOG_WARN("h264: vesper was built without VESPER_WITH_X264. h264 disabled.");
+        opts.encoding.h264.enabled = false;
+    }
+
+    if (opts.encoding.h264.enabled && !h264ExtensionRegistered) {
+        static int h264Encodings[] = { H264Encoder::ENCODING, 0 };
+
+        h264Extension = {};
+        h264Extension.pseudoEncodings = h264Encodings;
+        h264Extension.enablePseudoEncoding = [] (
+            rfbClientPtr cl, void** extData, int encoding
+        ) -> rfbBool {
+            auto* data = (ClientData*) cl->clientData;
+            if (data == nullptr || encoding != H264Encoder::ENCODING) {
+                return FALSE;
+            }
+
+            // SetEncodings 按客户端的偏好排列。此时还没有确定首选编码，说明 H.264 排在最前。
+
+            bool requested = cl->preferredEncoding == -1;
+            data->h264.setEncodingsCount = rfbStatGetMessageCountRcvd(cl, rfbSetEncodings);
+
+            if (requested != data->h264.requested) {
+                data->h264.requested = requested;
+                LOG_INFO("h264 ", requested ? "enabled" : "disabled", " for client ", cl->host, ".");
+            }
+
+            return TRUE;
+        };
+
+        rfbRegisterProtocolExtension(&h264Extension);
+        h264ExtensionRegistered = true;
+    }
+
+    // QEMU Extended Key Event：客户端声明伪编码后，回复确认，之后以 QEMU 客户端消息发送按键。
+
+    if (opts.input.extendedKeyEvent && !extendedKeyEventExtensionRegistered) {
+        static int pseudoEncodings[] = { int(rfbEncodingQemuExtendedKeyEvent), 0 };
+
+        extendedKeyEventExtension = {};
+        extendedKeyEventExtension.pseudoEncodings = pseudoEncodings;
+        extendedKeyEventExtension.enablePseudoEncoding = [] (
+            rfbClientPtr cl, void** extData, int encoding
+        ) -> rfbBool {
+            if (encoding != int(rfbEncodingQemuExtendedKeyEvent)) {
+                return FALSE;
+            }
+
+            sendExtendedKeyEventAck(cl);
+            return TRUE;
+        };
+
+        // libvncserver 只读出了消息类型，其余部分由这里读取。
+
+        extendedKeyEventExtension.handleMessage = [] (
+            rfbClientPtr cl, void* data, const rfbClientToServerMsg* message
+        ) -> rfbBool {
+            if (message->type != rfbQemuEvent) {
+                return FALSE;
+            }
+
+            rfbQemuExtendedKeyEventMsg msg;
+            msg.type = message->type;
+
+            int n = rfbReadExact(cl, ((char*) &msg) + 1, sz_rfbQemuExtendedKeyEventMsg - 1);
+            if (n <= 0) {
+                if (n != 0) {
+                    rfbLogPerror("rfbProcessClientNormalMessage: read");
+                }
+                rfbCloseClient(cl);
+                return TRUE;
+            }
+
+            // 只声明了扩展按键事件，其他子类型无法得知长度。
+
+            if (msg.subtype != 0) {
+                LOG_WARN("unsupported qemu message subtype ", int(msg.subtype), " from client ", cl->host, ".");
+                rfbCloseClient(cl);
+                return TRUE;
+            }
+
+            auto* server = (Server*) cl->screen->screenData;
+            lock_guard lock(server->inputMutex);
+            server->scancodeEventHandler(
+                Swap16IfLE(msg.down) != 0, Swap32IfLE(msg.keycode), Swap32IfLE(msg.keysym), cl
+            );
+
+            return TRUE;
+        };
+
+        rfbRegisterProtocolExtension(&extendedKeyEventExtension);
+        extendedKeyEventExtensionRegistered = true;
+    }
+
     rfbServer->screenData = this;
     rfbServer->desktopName = "vesper remote";
 
     rfbInitServer(rfbServer);
 
+    if (opts.net.threadedClients) {
+        rfbRunEventLoop(rfbServer, -1, TRUE);
+    }
+
+    tileChangeStats.resize(opts.screenBuffer.width, opts.screenBuffer.height);
+    tileHasher.resize(opts.screenBuffer.width, opts.screenBuffer.height);
+    frameDamage.resize(opts.screenBuffer.width, opts.screenBuffer.height);
+    heldVideoDamage.resize(opts.screenBuffer.width, opts.screenBuffer.height);
+    encodedTileCache.resize(opts.screenBuffer.width, opts.screenBuffer.height);
+    if (tileEncodingEnabled()) {
+        encodedTileCache.setThreads(opts.encoding.encodeThreads);
+    }
+
+    if (opts.encoding.h264.enabled) {
+        i420Frame.resize(opts.screenBuffer.width, opts.screenBuffer.height);
+        i420Damage.resize(opts.screenBuffer.width, opts.screenBuffer.height);
+        i420Damage.setAll();
+    }
+
+    thumbnailEnabled = opts.thumbnail.width > 0 && opts.thumbnail.height > 0;
+    if (thumbnailEnabled) {
+        thumbnail.frameRate = opts.thumbnail.frameRate;
+        thumbnail.quality = opts.thumbnail.quality;
+        thumbnail.resize(
+            opts.screenBuffer.width, opts.screenBuffer.height, 
+            opts.thumbnail.width, opts.thumbnail.height
+        );
+
+        LOG_INFO("thumbnail size: ", thumbnail.width(), "x", thumbnail.height());
+    }
+
 
     // event loop
 
@@ -120,27 +762,97 @@ int Server::run() {
     this->systemRunning = true;
 
     while (systemRunning) {
-        bool usingFramebufFallback = rfbServer->frameBuffer == framebufferFallback;
+        // 缩略图到了刷新时间也需要新画面，即使没有客户端连接。
 
-        if (!usingFramebufFallback && rfbServer->frameBuffer && options.screenBuffer.recycleBuffer) {
-            options.screenBuffer.recycleBuffer(rfbServer->frameBuffer);
+        bool demanded = clientsAwaitingUpdate(rfbServer)
+            || (thumbnailEnabled && thumbnail.due(currTimeNsec()));
+        if (demanded != framebufferDemanded) {
+            framebufferDemanded = demanded;
+            if (options.screenBuffer.demandChanged) {
+                options.screenBuffer.demandChanged(demanded);
+            }
         }
 
-        if (options.screenBuffer.getBuffer) {
-            rfbServer->frameBuffer = (char*) options.screenBuffer.getBuffer(this->frameDamage);
+        bool newFrame;
+
+        if (options.net.threadedClients) {
+            newFrame = this->copyLatestFrame();
         } else {
-            rfbServer->frameBuffer = nullptr;
-        }
+            bool usingFramebufFallback = rfbServer->frameBuffer == framebufferFallback;
+
+            if (!usingFramebufFallback && rfbServer->frameBuffer && options.screenBuffer.recycleBuffer) {
+                options.screenBuffer.recycleBuffer(rfbServer->frameBuffer);
+            }
+
+            if (options.screenBuffer.getBuffer) {
+                rfbServer->frameBuffer = (char*) options.screenBuffer.getBuffer(
+                    this->frameDamage, &this->frameVideoRegion
+                );
+            } else {
+                rfbServer->frameBuffer = nullptr;
+            }
+
+            if (rfbServer->frameBuffer == nullptr) {
+                rfbServer->frameBuffer = this->framebufferFallback;
+            }
 
-        if (rfbServer->frameBuffer == nullptr) {
-            rfbServer->frameBuffer = this->framebufferFallback;
+            newFrame = rfbServer->frameBuffer != framebufferFallback;
         }
 
-        if (rfbServer->frameBuffer != framebufferFallback) {
+        if (newFrame) {
+
+            // 先剔除假 damage，后面的统计和编码都只看真正变化的部分。
+
+            if (options.encoding.tileHashFilter) {
+                tileHasher.filterDamage((const uint32_t*) rfbServer->frameBuffer, frameDamage);
+            } else if (options.encoding.tileCacheSize > 0) {
+                // 分块缓存需要最新的哈希，但不剔除 damage。
+                TileBitmap damage = frameDamage;
+                tileHasher.filterDamage((const uint32_t*) rfbServer->frameBuffer, damage);
+            }
+
+            // 视频区域的 damage 可能被推迟标记，但画面已经变了，编码结果要立即作废。
+
+            if (tileEncodingEnabled()) {
+                encodedTileCache.invalidate(frameDamage);
+            }
+
+            if (thumbnailEnabled) {
+                thumbnail.addDamage(frameDamage);
+                thumbnail.refresh((const uint32_t*) rfbServer->frameBuffer, currTimeNsec());
+            }
+
+            if (options.encoding.videoDetection) {
+                this->holdVideoDamage();
+            }
+
             markDamagedAreas(rfbServer, frameDamage);
+
+            if (options.encoding.h264.enabled) {
+                i420Damage |= frameDamage;
+                this->sendH264Updates();
+            }
+
+            if (options.encoding.tileCacheSize > 0) {
+                this->sendCachedTiles();
+            }
+
+            if (tileEncodingEnabled()) {
+                this->sendSharedUpdates();
+            }
+        }
+
+        this->updateClientsQuality();
+
+        if (options.net.maxSendQueueKb > 0) {
+            this->paceClients();
         }
 
-        rfbProcessEvents(rfbServer, 16000);
+        if (options.net.threadedClients) {
+            this_thread::sleep_for(chrono::milliseconds(16));
+        } else {
+            rfbProcessEvents(rfbServer, 16000);
+        }
     }
 
     // clean up
@@ -151,27 +863,752 @@ int Server::run() {
 }
 
 void Server::clear() {
-    if (this->framebufferFallback) {
-        delete[] this->framebufferFallback;
-        this->framebufferFallback = nullptr;
+    if (this->framebufferDemanded) {
+        this->framebufferDemanded = false;
+        if (options.screenBuffer.demandChanged) {
+            options.screenBuffer.demandChanged(false);
+        }
     }
 
+    // 先停止客户端线程，再释放它们可能在读的帧缓冲。
+
     if (this->rfbServer) {
         rfbShutdownServer(rfbServer, true);
         rfbScreenCleanup(rfbServer);
         this->rfbServer = nullptr;
     }
 
+    if (this->framebufferFallback) {
+        delete[] this->framebufferFallback;
+        this->framebufferFallback = nullptr;
+    }
+
+    if (this->framebufferCopy) {
+        delete[] this->framebufferCopy;
+        this->framebufferCopy = nullptr;
+    }
+    this->framebufferCopyValid = false;
+
+    if (this->tileCacheExtensionRegistered) {
+        rfbUnregisterProtocolExtension(&tileCacheExtension);
+        this->tileCacheExtensionRegistered = false;
+    }
+
+    if (this->h264ExtensionRegistered) {
+        rfbUnregisterProtocolExtension(&h264Extension);
+        this->h264ExtensionRegistered = false;
+    }
+
+    if (this->extendedKeyEventExtensionRegistered) {
+        rfbUnregisterProtocolExtension(&extendedKeyEventExtension);
+        this->extendedKeyEventExtensionRegistered = false;
+    }
+
     mouseData.prevX = mouseData.prevY = -1;
     mouseData.prevButtonMask = 0;
 }
 
 
+bool Server::copyLatestFrame() {
+    char* rented = nullptr;
+    if (options.screenBuffer.getBuffer) {
+        rented = (char*) options.screenBuffer.getBuffer(frameDamage, &frameVideoRegion);
+    }
+
+    // 没有新画面时，客户端线程继续读上一份副本，不退回到空白的 framebufferFallback。
+
+    if (rented == nullptr) {
+        rfbServer->frameBuffer = framebufferCopyValid ? framebufferCopy : framebufferFallback;
+        return false;
+    }
+
+    const int tileSize = TileBitmap::TILE_SIZE;
+    const size_t stride = size_t(rfbServer->width) * 4;
+
+    if (!framebufferCopyValid) {
+        memcpy(framebufferCopy, rented, stride * rfbServer->height);
+        framebufferCopyValid = true;
+    } else {
+        frameDamage.forEachRun([&] (int row, int column, int end) {
+            size_t offset = size_t(column) * tileSize * 4;
+            size_t length = size_t(min(end * tileSize, rfbServer->width) - column * tileSize) * 4;
+            int yEnd = min((row + 1) * tileSize, rfbServer->height);
+
+            for (int y = row * tileSize; y < yEnd; y++) {
+                memcpy(framebufferCopy + y * stride + offset, rented + y * stride + offset, length);
+            }
+        });
+    }
+
+    if (options.screenBuffer.recycleBuffer) {
+        options.screenBuffer.recycleBuffer(rented);
+    }
+
+    // 客户端线程可能正在读取被覆盖的块。这些块随后会被标记为 damage，再发送一次。
+
+    rfbServer->frameBuffer = framebufferCopy;
+    return true;
+}
+
+
+void Server::holdVideoDamage() {
+    int64_t nowNsec = currTimeNsec();
+
+    tileChangeStats.update(frameDamage, nowNsec);
+    frameVideoRegion += tileChangeStats.videoRegion();
+
+    if (options.encoding.videoFrameRate <= 0) {
+        return;
+    }
+
+    // 视频区域的 damage 先攒着，到时间再统一发送。画面本身总是最新的，只是推迟标记。
+
+    TileBitmap videoDamage = frameDamage;
+    videoDamage &= tileChangeStats.videoTiles();
+    heldVideoDamage |= videoDamage;
+    frameDamage.subtract(videoDamage);
+
+    int64_t intervalNsec = 1000000000ll / options.encoding.videoFrameRate;
+    if (!heldVideoDamage.empty() && nowNsec - lastVideoFlushNsec >= intervalNsec) {
+        frameDamage |= heldVideoDamage;
+        heldVideoDamage.clear();
+        lastVideoFlushNsec = nowNsec;
+    }
+}
+
+
+void Server::sendCachedTiles() {
+    rfbClientIteratorPtr iterator = rfbGetClientIterator(rfbServer);
+    rfbClientPtr cl;
+    while ((cl = rfbClientIteratorNext(iterator)) != nullptr) {
+        if (!tileCacheUsable(cl)) {
+            continue;
+        }
+
+        auto* data = (ClientData*) cl->clientData;
+
+        // 客户端保存的是旧像素格式下的像素，格式变了就不能再用。
+
+        if (!samePixelFormat(data->tileCacheFormat, cl->format)) {
+            data->tileCache.clear();
+            data->tileCacheFormat = cl->format;
+        }
+
+        // 与 sendSharedUpdates 一样，整条更新由 vesper 组装，这里只处理没有其他附加内容的更新。
+
+        RectEncoder rectEncoder = rectEncoderFor(cl->preferredEncoding);
+
+        bool usable = rectEncoder != nullptr
+            && !data->congested
+            && !data->h264.requested
+            && !cl->cursorWasChanged
+            && !cl->cursorWasMoved
+            && !cl->newFBSizePending
+            && !cl->enableSupportedMessages
+            && !cl->enableSupportedEncodings
+            && !cl->enableServerIdentity
+            && sraRgnEmpty(cl->copyRegion)
+            && !sraRgnEmpty(cl->requestedRegion);
+
+        if (!usable) {
+            continue;
+        }
+
+        pixman::Region32 pending;
+        sraRgnToRegion32(cl->modifiedRegion, pending);
+        if (pending.empty()) {
+            continue;
+        }
+
+        pixman::Region32 requested;
+        sraRgnToRegion32(cl->requestedRegion, requested);
+        pending.intersectWith(requested);
+        if (pending.empty()) {
+            continue;
+        }
+
+        TileBitmap tiles;
+        tiles.resize(rfbServer->width, rfbServer->height);
+        tiles.addRegion(pending);
+
+        // 命中的块整块从缓存取出。块内没有变化的部分也是最新内容，不影响正确性。
+
+        vector<TileCacheRect> hits;
+        pixman::Region32 hitRegion;
+
+        tiles.forEachRun([&] (int row, int column, int end) {
+            for (; column < end; column++) {
+                TileHasher::Hash hash;
+                if (!tileHasher.tileHash(column, row, hash)) {
+                    continue;
+                }
+
+                int slot = data->tileCache.lookup(hash);
+                if (slot < 0) {
+                    continue;
+                }
+
+                auto box = tileBox(rfbServer, column, row);
+                hits.push_back({ .box = box, .slot = slot });
+                hitRegion += box;
+            }
+        });
+
+        pixman::Region32 remaining;
+        remaining.subtract(pending, hitRegion);
+
+#ifdef LIBVNCSERVER_HAVE_LIBJPEG
+        bool lossy = cl->preferredEncoding == rfbEncodingTight && cl->turboQualityLevel >= 0;
+#else
+        bool lossy = false;
+#endif
+
+        // 以无损方式完整发送的块，让客户端存起来。ZYWRLE 是有损的，客户端手上的像素与哈希对不上。
+        // 同内容的块已经在缓存里时，不必再存一份。
+
+        vector<TileCacheRect> stores;
+
+        if (!lossy && cl->preferredEncoding != rfbEncodingZYWRLE) {
+            tiles.forEachRun([&] (int row, int column, int end) {
+                for (; column < end; column++) {
+                    auto box = tileBox(rfbServer, column, row);
+                    if (pixman_region32_contains_rectangle(remaining.raw(), &box) != PIXMAN_REGION_IN) {
+                        continue;
+                    }
+
+                    TileHasher::Hash hash;
+                    if (!tileHasher.tileHash(column, row, hash) || data->tileCache.lookup(hash) >= 0) {
+                        continue;
+                    }
+
+                    stores.push_back({ .box = box, .slot = data->tileCache.insert(hash) });
+                }
+            });
+        }
+
+        if (hits.empty() && stores.empty()) {
+            continue;  // 与缓存无关，交给 libvncserver。
+        }
+
+        // 一个请求只回应一条更新：先取缓存，再编码其余部分，最后让客户端保存刚画好的块。
+        // 矩形数事先无法确定，以 LastRect 结尾。
+
+        rfbFramebufferUpdateMsg updateMsg;
+        updateMsg.type = rfbFramebufferUpdate;
+        updateMsg.pad = 0;
+        updateMsg.nRects = Swap16IfLE(uint16_t(0xFFFF));
+        memcpy(cl->updateBuf, &updateMsg, sz_rfbFramebufferUpdateMsg);
+        cl->ublen = sz_rfbFramebufferUpdateMsg;
+
+        bool written = appendTileCacheRects(cl, TileCache::ENCODING_HIT, hits);
+
+        int nRects;
+        const pixman_box32_t* rects = remaining.rectangles(&nRects);
+        for (int i = 0; i < nRects && written; i++) {
+            auto& it = rects[i];
+            written = rectEncoder(cl, it.x1, it.y1, it.x2 - it.x1, it.y2 - it.y1);
+        }
+
+        written = written
+            && appendTileCacheRects(cl, TileCache::ENCODING_STORE, stores)
+            && rfbSendLastRectMarker(cl)
+            && rfbSendUpdateBuf(cl);
+
+        if (!written) {
+            LOG_WARN("failed to send tile cache update to client ", cl->host, ".");
+            if (cl->sock >= 0) {
+                rfbCloseClient(cl);
+            }
+
+            continue;
+        }
+
+        // 与 libvncserver 发送完一次更新后的状态保持一致。
+
+        sraRegionPtr sentRgn = region32ToSraRgn(pending);
+        sraRgnSubtract(cl->modifiedRegion, sentRgn);
+        sraRgnDestroy(sentRgn);
+        sraRgnMakeEmpty(cl->requestedRegion);
+
+        data->sending.region = remaining;
+        data->sending.lossy = lossy;
+        if (rfbServer->displayFinishedHook) {
+            rfbServer->displayFinishedHook(cl, TRUE);
+        }
+
+        data->lossyRegion -= hitRegion;
+    }
+    rfbReleaseClientIterator(iterator);
+}
+
+
+void Server::sendSharedUpdates() {
+    const size_t MAX_RECTS = 0xFFFF;
+
+    rfbClientIteratorPtr iterator = rfbGetClientIterator(rfbServer);
+    rfbClientPtr cl;
+    while ((cl = rfbClientIteratorNext(iterator)) != nullptr) {
+        auto* data = (ClientData*) cl->clientData;
+
+        if (data && data->zeroCopy.enabled()) {
+            data->zeroCopy.reap(cl->sock);
+        }
+
+        if (!sharedUpdateUsable(cl, options.encoding.sharedEncoding) || data->congested) {
+            continue;
+        }
+        int32_t encoding = cl->preferredEncoding;
+
+        pixman::Region32 pending;
+        sraRgnToRegion32(cl->modifiedRegion, pending);
+        if (pending.empty()) {
+            continue;
+        }
+
+        pixman::Region32 requested;
+        sraRgnToRegion32(cl->requestedRegion, requested);
+        pending.intersectWith(requested);
+        if (pending.empty()) {
+            continue;
+        }
+
+        TileBitmap tiles;
+        tiles.resize(rfbServer->width, rfbServer->height);
+        tiles.addRegion(pending);
+
+        encodedTileCache.prepare(cl, tiles, encoding);
+
+        // 先取齐所有块的编码结果。中途失败时交还给 libvncserver，客户端的流不受影响。
+
+        vector<pair<pixman_box32_t, shared_ptr<const string>>> rects;
+        bool failed = false;
+
+        tiles.forEachRun([&] (int row, int column, int end) {
+            for (; column < end && !failed; column++) {
+                auto encoded = encodedTileCache.get(cl, column, row, encoding);
+                if (encoded == nullptr) {
+                    failed = true;
+                    break;
+                }
+
+                rects.push_back({ tileBox(rfbServer, column, row), encoded });
+            }
+        });
+
+        if (failed || rects.empty() || rects.size() > MAX_RECTS) {
+            continue;
+        }
+
+        string zlibPrefix;
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+        if (encoding == rfbEncodingZlib && !flushClientZlibStream(cl, zlibPrefix)) {
+            continue;
+        }
+#endif
+
+        // 组装 FramebufferUpdate 消息。所有头部放在一起，块数据直接引用缓存。
+
+        auto headers = make_shared<string>();
+        vector<size_t> headerEnds;
+
+        rfbFramebufferUpdateMsg updateMsg;
+        updateMsg.type = rfbFramebufferUpdate;
+        updateMsg.pad = 0;
+        updateMsg.nRects = Swap16IfLE(uint16_t(rects.size()));
+        headers->append((const char*) &updateMsg, sz_rfbFramebufferUpdateMsg);
+
+        pixman::Region32 sent;
+        size_t totalSize = 0;
+
+        for (auto& [box, encoded] : rects) {
+            rfbFramebufferUpdateRectHeader header;
+            header.r.x = Swap16IfLE(uint16_t(box.x1));
+            header.r.y = Swap16IfLE(uint16_t(box.y1));
+            header.r.w = Swap16IfLE(uint16_t(box.x2 - box.x1));
+            header.r.h = Swap16IfLE(uint16_t(box.y2 - box.y1));
+            header.encoding = Swap32IfLE(uint32_t(encoding));
+            headers->append((const char*) &header, sz_rfbFramebufferUpdateRectHeader);
+
+            if (encoding == rfbEncodingZlib) {
+                uint32_t nBytes = Swap32IfLE(uint32_t(zlibPrefix.size() + encoded->size()));
+                headers->append((const char*) &nBytes, sizeof(nBytes));
+                *headers += zlibPrefix;
+                zlibPrefix.clear();
+            }
+
+            headerEnds.push_back(headers->size());
+            totalSize += encoded->size();
+            sent += box;
+        }
+
+        totalSize += headers->size();
+
+        vector<ZeroCopySender::Segment> segments;
+        size_t headerBegin = 0;
+        for (size_t i = 0; i < rects.size(); i++) {
+            segments.push_back({ headers->data() + headerBegin, headerEnds[i] - headerBegin });
+            segments.push_back({ rects[i].second->data(), rects[i].second->size() });
+            headerBegin = headerEnds[i];
+        }
+
+        bool written;
+
+        if (data->zeroCopy.enabled() && totalSize >= ZeroCopySender::MIN_MESSAGE_SIZE) {
+            vector<shared_ptr<const void>> keepAlive { headers };
+            for (auto& it : rects) {
+                keepAlive.push_back(it.second);
+            }
+
+            written = data->zeroCopy.send(cl->sock, segments, std::move(keepAlive), rfbMaxClientWait);
+        } else {
+            string msg;
+            msg.reserve(totalSize);
+            for (auto& it : segments) {
+                msg.append(it.data, it.length);
+            }
+
+            written = rfbWriteExact(cl, msg.data(), int(msg.size())) >= 0;
+        }
+
+        if (!written) {
+            LOG_WARN("failed to send shared update to client ", cl->host, ".");
+            rfbCloseClient(cl);
+            continue;
+        }
+
+        // 与 libvncserver 发送完一次更新后的状态保持一致。
+
+        sraRegionPtr sentRgn = region32ToSraRgn(sent);
+        sraRgnSubtract(cl->modifiedRegion, sentRgn);
+        sraRgnDestroy(sentRgn);
+        sraRgnMakeEmpty(cl->requestedRegion);
+
+        data->sending.region = sent;
+        data->sending.lossy = false;
+        if (rfbServer->displayFinishedHook) {
+            rfbServer->displayFinishedHook(cl, TRUE);
+        }
+    }
+    rfbReleaseClientIterator(iterator);
+}
+
+
+void Server::sendH264Updates() {
+    auto& h264 = options.encoding.h264;
+
+    int64_t nowNsec = currTimeNsec();
+    int64_t intervalNsec = 1000000000ll / max(h264.frameRate, 1);
+    bool converted = false;
+
+    // 一帧覆盖整个画面。宽高为奇数时，剩下的一行或一列仍由 libvncserver 发送。
+
+    pixman_box32_t box = { 0, 0, i420Frame.width(), i420Frame.height() };
+    if (box.x2 <= 0 || box.y2 <= 0) {
+        return;
+    }
+
+    pixman::Region32 boxRegion;
+    boxRegion += box;
+
+    rfbClientIteratorPtr iterator = rfbGetClientIterator(rfbServer);
+    rfbClientPtr cl;
+    while ((cl = rfbClientIteratorNext(iterator)) != nullptr) {
+        auto* data = (ClientData*) cl->clientData;
+        if (data == nullptr) {
+            continue;
+        }
+
+        expireH264Request(cl);
+
+        // 暂时不能用 H.264 发送时，把攒着的区域还给 libvncserver。
+
+        if (!h264UpdateUsable(cl) || data->congested) {
+            if (data->h264.pending.notEmpty()) {
+                sraRegionPtr pending = region32ToSraRgn(data->h264.pending);
+                sraRgnOr(cl->modifiedRegion, pending);
+                sraRgnDestroy(pending);
+                data->h264.pending.clear();
+            }
+
+            continue;
+        }
+
+        pixman::Region32 modified;
+        sraRgnToRegion32(cl->modifiedRegion, modified);
+        modified.intersectWith(boxRegion);
+        data->h264.pending += modified;
+
+        sraRegionPtr boxRgn = sraRgnCreateRect(box.x1, box.y1, box.x2, box.y2);
+        sraRgnSubtract(cl->modifiedRegion, boxRgn);
+        sraRgnDestroy(boxRgn);
+
+        if (data->h264.pending.empty() || sraRgnEmpty(cl->requestedRegion)) {
+            continue;
+        }
+
+        if (nowNsec - data->h264.lastFrameNsec < intervalNsec) {
+            continue;
+        }
+
+        if (data->h264.encoder == nullptr) {
+            data->h264.encoder = make_unique<H264Encoder>();
+            if (!data->h264.encoder->open(box.x2, box.y2, h264.bitrateKbps, h264.frameRate)) {
+                LOG_WARN("h264: failed to open encoder for client ", cl->host, ".");
+                data->h264.encoder.reset();
+                data->h264.requested = false;
+                continue;
+            }
+
+            data->h264.resetPending = true;
+        }
+
+        if (!converted) {
+            i420Frame.update((const uint32_t*) rfbServer->frameBuffer, i420Damage);
+            i420Damage.clear();
+            converted = true;
+        }
+
+        string nal;
+        if (!data->h264.encoder->encode(i420Frame, nal)) {
+            LOG_WARN("h264: failed to encode for client ", cl->host, ".");
+            data->h264.encoder.reset();
+            data->h264.requested = false;
+            continue;
+        }
+
+        if (nal.empty()) {
+            continue;
+        }
+
+        // FramebufferUpdate 消息，只有一个矩形。矩形数据为：长度、标志、H.264 码流。
+
+        string msg;
+
+        rfbFramebufferUpdateMsg updateMsg;
+        updateMsg.type = rfbFramebufferUpdate;
+        updateMsg.pad = 0;
+        updateMsg.nRects = Swap16IfLE(uint16_t(1));
+        msg.append((const char*) &updateMsg, sz_rfbFramebufferUpdateMsg);
+
+        rfbFramebufferUpdateRectHeader header;
+        header.r.x = Swap16IfLE(uint16_t(box.x1));
+        header.r.y = Swap16IfLE(uint16_t(box.y1));
+        header.r.w = Swap16IfLE(uint16_t(box.x2 - box.x1));
+        header.r.h = Swap16IfLE(uint16_t(box.y2 - box.y1));
+        header.encoding = Swap32IfLE(uint32_t(H264Encoder::ENCODING));
+        msg.append((const char*) &header, sz_rfbFramebufferUpdateRectHeader);
+
+        uint32_t length = Swap32IfLE(uint32_t(nal.size()));
+        uint32_t flags = Swap32IfLE(data->h264.resetPending ? H264Encoder::FLAG_RESET_CONTEXT : 0u);
+        msg.append((const char*) &length, sizeof(length));
+        msg.append((const char*) &flags, sizeof(flags));
+        msg += nal;
+
+        if (rfbWriteExact(cl, msg.data(), int(msg.size())) < 0) {
+            LOG_WARN("failed to send h264 update to client ", cl->host, ".");
+            rfbCloseClient(cl);
+            continue;
+        }
+
+        sraRgnMakeEmpty(cl->requestedRegion);
+
+        // H.264 不参与无损重发：重发的区域仍会按 H.264 发送，永远得不到无损画面。
+        // 静止画面由编码器自己逐帧提高质量。
+
+        {
+            lock_guard dataLock(data->mutex);
+            data->lossyRegion -= data->h264.pending;
+            data->refining = false;
+        }
+
+        data->h264.pending.clear();
+        data->h264.resetPending = false;
+        data->h264.lastFrameNsec = nowNsec;
+    }
+    rfbReleaseClientIterator(iterator);
+}
+
+
+void Server::updateClientsQuality() {
+#ifdef LIBVNCSERVER_HAVE_LIBJPEG
+    auto& encoding = options.encoding;
+    bool adaptive = encoding.contentAwareQuality || encoding.videoDetection;
+    bool refine = encoding.losslessRefineDelayMs > 0;
+
+    if (!adaptive && !refine) {
+        return;
+    }
+
+    int64_t nowNsec = currTimeNsec();
+    int64_t refineDelayNsec = int64_t(encoding.losslessRefineDelayMs) * 1000000;
+
+    rfbClientIteratorPtr iterator = rfbGetClientIterator(rfbServer);
+    rfbClientPtr cl;
+    while ((cl = rfbClientIteratorNext(iterator)) != nullptr) {
+        auto* data = (ClientData*) cl->clientData;
+        if (data == nullptr) {
+            continue;
+        }
+
+        ClientUpdateLock updateLock(cl);
+        lock_guard dataLock(data->mutex);
+
+        // 客户端重新发送了 SetEncodings，turboQualityLevel 此时是客户端自己请求的值。
+
+        int setEncodingsCount = rfbStatGetMessageCountRcvd(cl, rfbSetEncodings);
+        if (setEncodingsCount != data->qualitySetEncodingsCount) {
+            data->qualitySetEncodingsCount = setEncodingsCount;
+            data->preferredQuality = cl->turboQualityLevel;
+        }
+
+        if (data->congested) {
+            continue;
+        }
+
+        pixman::Region32 pending;
+        sraRgnToRegion32(cl->modifiedRegion, pending);
+
+        // 没有新画面要发时，把静止下来的有损区域重新放进待发送区域。
+
+        if (pending.empty()) {
+            bool refineDue = refine && !data->refining
+                && data->lossyRegion.notEmpty()
+                && nowNsec - data->lastLossyNsec >= refineDelayNsec;
+
+            if (!refineDue) {
+                continue;
+            }
+
+            sraRegionPtr lossy = region32ToSraRgn(data->lossyRegion);
+            sraRgnOr(cl->modifiedRegion, lossy);
+            sraRgnDestroy(lossy);
+
+            data->refining = true;
+        }
+
+        int quality = data->preferredQuality;
+
+        if (adaptive) {
+            pixman::Region32 video = pending;
+            video.intersectWith(frameVideoRegion);
+
+            bool lossy = video.notEmpty() && video.regionArea() * 2 >= pending.regionArea();
+
+            quality = -1;
+            if (lossy) {
+                quality = data->preferredQuality > 0 ? data->preferredQuality : encoding.lossyQuality;
+            }
+        }
+
+        if (data->refining) {
+            quality = -1;
+        }
+
+        cl->turboQualityLevel = quality;
+    }
+    rfbReleaseClientIterator(iterator);
+#endif
+}
+
+
+void Server::paceClients() {
+    const int maxQueued = options.net.maxSendQueueKb * 1024;
+
+    rfbClientIteratorPtr iterator = rfbGetClientIterator(rfbServer);
+    rfbClientPtr cl;
+    while ((cl = rfbClientIteratorNext(iterator)) != nullptr) {
+        auto* data = (ClientData*) cl->clientData;
+        if (data == nullptr || cl->sock < 0) {
+            continue;
+        }
+
+        int queued = 0;
+        if (ioctl(cl->sock, SIOCOUTQ, &queued) < 0) {
+            queued = 0;
+        }
+
+        bool congested = queued > maxQueued;
+
+        ClientUpdateLock updateLock(cl);
+
+        if (congested) {
+
+            // 新画面先记下来不编码。等能发出去时，帧缓冲里已经是更新的内容了。
+
+            pixman::Region32 pending;
+            sraRgnToRegion32(cl->modifiedRegion, pending);
+            if (pending.notEmpty()) {
+                data->deferredRegion += pending;
+                sraRgnMakeEmpty(cl->modifiedRegion);
+            }
+        } else if (data->congested && data->deferredRegion.notEmpty()) {
+            sraRegionPtr deferred = region32ToSraRgn(data->deferredRegion);
+            sraRgnOr(cl->modifiedRegion, deferred);
+            sraRgnDestroy(deferred);
+
+            data->deferredRegion.clear();
+        }
+
+        data->congested = congested;
+    }
+    rfbReleaseClientIterator(iterator);
+}
+
+
 void Server::terminate() {
     this->systemRunning = false;
 }
 
 
+bool Server::acceptWebSocketClient(rfbClientPtr cl) {
+#ifdef LIBVNCSERVER_WITH_WEBSOCKETS
+    if (cl->wsctx == nullptr) {
+        return true;
+    }
+
+    auto& websocket = options.net.websocket;
+    if (!websocket.enabled) {
+        LOG_WARN("websocket client ", cl->host, " refused: websocket is disabled.");
+        return false;
+    }
+
+    // 一次画面更新可能有几 MB。发送缓冲区太小时，libvncserver 会频繁阻塞等待。
+
+    if (websocket.sendBufferKb > 0) {
+        int size = websocket.sendBufferKb * 1024;
+        if (setsockopt(cl->sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) < 0) {
+            LOG_WARN("websocket: failed to set send buffer size for ", cl->host, ".");
+        }
+    }
+
+    LOG_INFO("websocket client connected: ", cl->host);
+#endif
+
+    return true;
+}
+
+
+bool Server::zeroCopyUsable(rfbClientPtr cl) {
+    if (!options.net.zeroCopy || !options.encoding.sharedEncoding) {
+        return false;
+    }
+
+#ifdef LIBVNCSERVER_WITH_WEBSOCKETS
+    if (cl->wsctx != nullptr) {
+        return false;  // WebSocket 需要给数据分帧，可能还要加密。
+    }
+#endif
+
+    return cl->sock >= 0;
+}
+
+
+bool Server::getThumbnail(string& jpeg) {
+    return thumbnail.latestJpeg(jpeg);
+}
+
+
 void Server::mouseEventHandler(int buttonMask, int x, int y, rfbClientPtr cl) {
     auto& motionHandler = options.eventHandlers.mouse.motion;
     auto& buttonHandler = options.eventHandlers.mouse.button;
@@ -252,4 +1689,16 @@ void Server::keyboardEventHandler(rfbBool down, rfbKeySym keySym, rfbClientPtr c
     
 }
 
+
+void Server::scancodeEventHandler(bool down, uint32_t xtScancode, rfbKeySym keySym, rfbClientPtr cl) {
+    auto& handler = options.eventHandlers.keyboard.scancode;
+    uint32_t scancode = xtScancodeToEvdevScancode(xtScancode);
+
+    if (handler && scancode) {
+        handler(down, scancode);
+    } else if (keySym) {
+        keyboardEventHandler(down, keySym, cl);
+    }
+}
+
 }
@@ -11,14 +11,21 @@
 #include <functional>
 #include <string>
 #include <semaphore>
+#include <mutex>
 #include "../log/Log.h"
 
 #include "../common/MouseButton.h"
+#include "../common/TileBitmap.h"
 
 #include <rfb/rfb.h>
 #include <xkbcommon/xkbcommon.h>
 
 #include "../bindings/pixman.h"
+#include "./TileChangeStats.h"
+#include "./TileHasher.h"
+#include "./EncodedTileCache.h"
+#include "./Thumbnail.h"
+#include "./I420Frame.h"
 
 
 namespace vesper::vnc {
@@ -36,8 +43,18 @@ public:
         struct {
             int width;
             int height;
-            std::function<void* (vesper::bindings::pixman::Region32& damage)> getBuffer;
+            std::function<void* (
+                vesper::common::TileBitmap& damage,
+                vesper::bindings::pixman::Region32* videoRegion
+            )> getBuffer;
             std::function<void (void*)> recycleBuffer;
+
+            /**
+             * 当“是否有客户端在等待新画面”发生变化时调用。
+             * 
+             * @param demand true 表示至少有一个客户端有未完成的画面更新请求，或缩略图到了刷新时间。
+             */
+            std::function<void (bool demand)> demandChanged;
         } screenBuffer;
 
         struct {
@@ -61,10 +78,25 @@ public:
 
             struct {
                 std::function<void (bool pressed, xkb_keysym_t keysym)> key;
+
+                /**
+                 * 客户端发来物理按键（input.extendedKeyEvent）时调用。没有设置时按 keysym 调用 key。
+                 *
+                 * @param scancode evdev 键码。
+                 */
+                std::function<void (bool pressed, uint32_t scancode)> scancode;
             } keyboard;
             
         } eventHandlers;
 
+        struct {
+            /**
+             * 支持 QEMU Extended Key Event 伪编码。声明支持的客户端在按键事件中附带 XT 扫描码，
+             * 直接按物理按键交给桌面，不再由 keysym 反查按键。无法识别的扫描码仍按 keysym 处理。
+             */
+            bool extendedKeyEvent = false;
+        } input;
+
         struct {
             std::string password;
             std::string libvncserverPasswdFile;
@@ -73,8 +105,119 @@ public:
         struct {
             /** -1 表示不设置。 */
             int port = -1;
+
+            /**
+             * 在 port 上直接接受 WebSocket 连接（如 noVNC），不再需要 websockify 转发。
+             * 需要 libvncserver 编译时启用 WebSocket 支持。关闭时拒绝 WebSocket 客户端。
+             */
+            struct {
+                bool enabled = false;
+
+                /** 同时设置证书和私钥时，支持 wss。 */
+                std::string certFile;
+                std::string keyFile;
+
+                /** WebSocket 客户端的 socket 发送缓冲区大小（KiB）。0 表示使用系统默认值。 */
+                int sendBufferKb = 0;
+            } websocket;
+
+            /**
+             * 共享编码路径（encoding.sharedEncoding）向普通 TCP 客户端发送大消息时，
+             * 使用 MSG_ZEROCOPY，直接从编码缓存发送，不再拷贝。
+             */
+            bool zeroCopy = false;
+
+            /**
+             * 客户端 socket 发送队列中尚未发出的数据超过这么多（KiB）时，暂不编码新画面，
+             * 等队列排空后再按最新画面发送。0 表示不限制。
+             */
+            int maxSendQueueKb = 0;
+
+            /**
+             * 每个客户端使用单独的线程收发数据和编码（libvncserver 的多线程模式），
+             * 一个客户端网络慢不会拖慢其他客户端和输入处理。
+             * 主循环把最新画面复制到自己的帧缓冲中，供各客户端线程读取。
+             * 开启后不能使用分块缓存和共享编码。
+             */
+            bool threadedClients = false;
         } net;
 
+        struct {
+            /**
+             * 对 damage 触及的每个 64x64 块计算哈希，剔除内容实际没有变化的块。
+             */
+            bool tileHashFilter = false;
+
+            /**
+             * 按内容类型选择编码质量：视频区域用有损编码，其余区域用无损编码。
+             * 关闭时完全按客户端的请求编码。
+             */
+            bool contentAwareQuality = false;
+
+            /** 客户端没有请求质量时，有损编码使用的 JPEG 质量（1-100）。 */
+            int lossyQuality = 80;
+
+            /**
+             * 根据各块画面的变化频率识别视频区域。识别出的区域按有损编码处理，
+             * 并以不超过 videoFrameRate 的帧率发送。
+             */
+            bool videoDetection = false;
+
+            /** 视频区域每秒最多发送几次。0 表示不限制。 */
+            int videoFrameRate = 24;
+
+            /**
+             * 有损发送的区域静止这么久（毫秒）后，在空闲时以无损方式重发一次。
+             * 0 表示不重发。
+             */
+            int losslessRefineDelayMs = 0;
+
+            /**
+             * 每个客户端最多缓存多少个 64x64 块。0 表示不启用分块缓存。
+             * 只对声明支持 TileCache::PSEUDO_ENCODING 的客户端生效。
+             */
+            int tileCacheSize = 0;
+
+            /**
+             * 使用 Raw 或 Zlib 编码、参数相同的客户端共用同一份编码结果。
+             * 适合多人同时观看同一画面。
+             */
+            bool sharedEncoding = false;
+
+            /**
+             * 一次更新中缺少的块用几个线程并行编码（含主线程）。
+             * 大于 1 时，即使没有开启共享编码，Zlib 客户端的更新也按块并行压缩。
+             * Zlib 的压缩级别仍由各客户端通过 CompressLevel 伪编码随时调整。
+             */
+            int encodeThreads = 1;
+
+            /**
+             * 对首选 Open H.264 编码的客户端，以 H.264 视频流发送整个画面。
+             * 需要构建时开启 VESPER_WITH_X264。
+             */
+            struct {
+                bool enabled = false;
+
+                /** 每个客户端的平均码率（kbps）。 */
+                int bitrateKbps = 4000;
+
+                /** 每秒最多编码几帧。 */
+                int frameRate = 30;
+            } h264;
+        } encoding;
+
+        struct {
+            /** 缩略图的最大尺寸。为 0 时不生成缩略图。 */
+            int width = 0;
+            int height = 0;
+
+            /** 每秒最多更新几次。 */
+            int frameRate = 1;
+
+            /** JPEG 质量（1-100）。 */
+            int quality = 70;
+        } thumbnail;
+
         struct {
 
             std::binary_semaphore serverLaunchedSignal {0};
@@ -90,6 +233,13 @@ public:
 
     void terminate();
 
+    /**
+     * 取出最新的缩略图（JPEG）。可以在其他线程调用。
+     *
+     * @return 没有启用缩略图或还没有生成时返回 false。
+     */
+    bool getThumbnail(std::string& jpeg);
+
 public:
 
     struct {
@@ -101,12 +251,117 @@ public:
     void mouseEventHandler(int buttonMask, int x, int y, rfbClientPtr cl);
     void keyboardEventHandler(rfbBool down, rfbKeySym keySym, rfbClientPtr cl);
 
+    /**
+     * @param xtScancode QEMU Extended Key Event 中的 XT 扫描码。
+     */
+    void scancodeEventHandler(bool down, uint32_t xtScancode, rfbKeySym keySym, rfbClientPtr cl);
+
+protected:
+
+    /**
+     * 新客户端连接时调用。不是 WebSocket 客户端时直接接受。
+     * 
+     * @return 是否接受该客户端。
+     */
+    bool acceptWebSocketClient(rfbClientPtr cl);
+
+    /**
+     * 能否为该客户端开启零拷贝发送。
+     */
+    bool zeroCopyUsable(rfbClientPtr cl);
+
+    /**
+     * 根据各客户端待发送区域中视频内容的占比，切换其有损或无损编码。
+     * 客户端空闲时，把静止下来的有损区域重新标记，以无损方式重发。
+     */
+    void updateClientsQuality();
+
+    /**
+     * 更新分块变化统计，并按 videoFrameRate 推迟视频区域的 damage。
+     */
+    void holdVideoDamage();
+
+    /**
+     * 待发送区域中客户端已缓存的块，改为让客户端从缓存中取出，不再发送像素。
+     * 其余部分按客户端的编码发送，完整无损发送的块随后让客户端存起来。三者放在同一条更新里。
+     */
+    void sendCachedTiles();
+
+    /**
+     * 是否由 vesper 自己按块编码并发送画面更新：开启了共享编码，或需要为 Zlib 客户端并行压缩。
+     */
+    bool tileEncodingEnabled() const {
+        return options.encoding.sharedEncoding || options.encoding.encodeThreads > 1;
+    }
+
+    /**
+     * 由 vesper 自己为可以共用编码结果的客户端发送画面更新，不经过 libvncserver 的编码器。
+     * 未开启共享编码时，只为 Zlib 客户端发送，以便多线程压缩。
+     */
+    void sendSharedUpdates();
+
+    /**
+     * 根据各客户端 socket 发送队列的积压情况，推迟或恢复其画面更新。
+     */
+    void paceClients();
+
+    /**
+     * 多线程模式下，取得最新画面，把变化的块复制到 framebufferCopy，并立即归还租来的画面。
+     *
+     * @return 取得了新画面时返回 true。否则不需要处理 damage。
+     */
+    bool copyLatestFrame();
+
+    /**
+     * 为首选 Open H.264 编码的客户端编码并发送画面。
+     */
+    void sendH264Updates();
+
 protected:
     rfbScreenInfoPtr rfbServer = nullptr;
     bool systemRunning;
 
     char* framebufferFallback = nullptr;
-    vesper::bindings::pixman::Region32 frameDamage;
+
+    /** 多线程模式下客户端线程读取的帧缓冲。 */
+    char* framebufferCopy = nullptr;
+    bool framebufferCopyValid = false;
+
+    /** 多线程模式下，各客户端的输入线程依次处理输入。 */
+    std::mutex inputMutex;
+
+    /** 上一次通过 demandChanged 报告的需求状态。 */
+    bool framebufferDemanded = false;
+
+    vesper::common::TileBitmap frameDamage;
+
+    /** 最新一帧中视频内容所在的区域。 */
+    vesper::bindings::pixman::Region32 frameVideoRegion;
+
+    TileChangeStats tileChangeStats;
+    TileHasher tileHasher;
+
+    EncodedTileCache encodedTileCache;
+
+    Thumbnail thumbnail;
+    bool thumbnailEnabled = false;
+
+    rfbProtocolExtension tileCacheExtension {};
+    bool tileCacheExtensionRegistered = false;
+
+    rfbProtocolExtension h264Extension {};
+    bool h264ExtensionRegistered = false;
+
+    rfbProtocolExtension extendedKeyEventExtension {};
+    bool extendedKeyEventExtensionRegistered = false;
+
+    /** 所有 H.264 客户端共用。只在有客户端要编码时，才转换累积的 damage。 */
+    I420Frame i420Frame;
+    vesper::common::TileBitmap i420Damage;
+
+    /** 因限制视频帧率而暂缓发送的 damage。 */
+    vesper::common::TileBitmap heldVideoDamage;
+    int64_t lastVideoFlushNsec = 0;
 
 };
 
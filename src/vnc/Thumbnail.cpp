@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 画面缩略图
+ *
+ * 创建于 2026年10月18日
+ */
+
+#include "./Thumbnail.h"
+#include "../log/Log.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+
+#include <jpeglib.h>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace vesper::common;
+
+namespace vesper::vnc {
+
+
+/**
+ * 16 位累加器不溢出的最大缩小倍数。每次累加 4 个像素，每个通道每次至多增加 2 * 255。
+ */
+static const int MAX_FACTOR = 256;
+
+
+void Thumbnail::resize(int srcWidth, int srcHeight, int maxWidth, int maxHeight) {
+    this->srcWidth = max(srcWidth, 0);
+    this->srcHeight = max(srcHeight, 0);
+
+    maxWidth = max(maxWidth, 1);
+    maxHeight = max(maxHeight, 1);
+
+    factor = max(
+        (this->srcWidth + maxWidth - 1) / maxWidth,
+        (this->srcHeight + maxHeight - 1) / maxHeight
+    );
+    factor = clamp(factor, 1, MAX_FACTOR);
+
+    dstWidth = (this->srcWidth + factor - 1) / factor;
+    dstHeight = (this->srcHeight + factor - 1) / factor;
+
+    pixels.assign(size_t(dstWidth) * dstHeight, 0);
+    rowBuffer.resize(size_t(dstWidth) * 3);
+
+    dirty.resize(this->srcWidth, this->srcHeight);
+    dirty.setAll();
+
+    lastRefreshNsec = 0;
+}
+
+
+void Thumbnail::addDamage(const TileBitmap& damage) {
+    dirty |= damage;
+}
+
+
+bool Thumbnail::due(int64_t nowNsec) const {
+    if (dstWidth == 0 || dstHeight == 0) {
+        return false;
+    }
+
+    bool refreshedBefore = lastRefreshNsec != 0;
+    return !refreshedBefore || frameRate <= 0 || nowNsec - lastRefreshNsec >= 1000000000ll / frameRate;
+}
+
+
+bool Thumbnail::refresh(const uint32_t* src, int64_t nowNsec) {
+    if (!due(nowNsec)) {
+        return false;
+    }
+
+    // 到了刷新时间但没有变化，也算刷新过一次。否则 due 一直为真，会一直要求新画面。
+
+    if (dirty.empty()) {
+        lastRefreshNsec = nowNsec;
+        return false;
+    }
+
+    const int tileSize = TileBitmap::TILE_SIZE;
+
+    dirty.forEachRun([&] (int row, int column, int end) {
+        int x1 = column * tileSize;
+        int y1 = row * tileSize;
+        int x2 = min(end * tileSize, srcWidth);
+        int y2 = min((row + 1) * tileSize, srcHeight);
+
+        downscale(src, x1 / factor, y1 / factor, (x2 + factor - 1) / factor, (y2 + factor - 1) / factor);
+    });
+
+    dirty.clear();
+    lastRefreshNsec = nowNsec;
+
+    string data;
+    if (!encodeJpeg(data)) {
+        return false;
+    }
+
+    jpeg.lock.acquire();
+    jpeg.data.swap(data);
+    jpeg.lock.release();
+
+    return true;
+}
+
+
+bool Thumbnail::latestJpeg(string& out) {
+    jpeg.lock.acquire();
+    out = jpeg.data;
+    jpeg.lock.release();
+
+    return !out.empty();
+}
+
+
+/**
+ * 对一块源像素按通道求和。
+ *
+ * @param sum 按内存中的字节顺序存放 4 个通道的和。
+ */
+static void sumBlock(const uint32_t* src, int stride, int width, int height, uint32_t sum[4]) {
+    sum[0] = sum[1] = sum[2] = sum[3] = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc32 = zero;
+#endif
+
+    for (int y = 0; y < height; y++) {
+        const uint32_t* row = src + size_t(y) * stride;
+        int x = 0;
+
+#if defined(__SSE2__)
+        __m128i acc16 = zero;
+        for (; x + 4 <= width; x += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i*) (row + x));
+            acc16 = _mm_add_epi16(acc16, _mm_unpacklo_epi8(p, zero));
+            acc16 = _mm_add_epi16(acc16, _mm_unpackhi_epi8(p, zero));
+        }
+
+        acc32 = _mm_add_epi32(acc32, _mm_unpacklo_epi16(acc16, zero));
+        acc32 = _mm_add_epi32(acc32, _mm_unpackhi_epi16(acc16, zero));
+#endif
+
+        for (; x < width; x++) {
+            uint32_t p = row[x];
+            sum[0] += p & 0xFF;
+            sum[1] += (p >> 8) & 0xFF;
+            sum[2] += (p >> 16) & 0xFF;
+            sum[3] += p >> 24;
+        }
+    }
+
+#if defined(__SSE2__)
+    alignas(16) uint32_t lanes[4];
+    _mm_store_si128((__m128i*) lanes, acc32);
+    for (int i = 0; i < 4; i++) {
+        sum[i] += lanes[i];
+    }
+#endif
+}
+
+
+void Thumbnail::downscale(const uint32_t* src, int dx1, int dy1, int dx2, int dy2) {
+    dx2 = min(dx2, dstWidth);
+    dy2 = min(dy2, dstHeight);
+
+    for (int dy = dy1; dy < dy2; dy++) {
+        int sy = dy * factor;
+        int blockHeight = min(factor, srcHeight - sy);
+
+        for (int dx = dx1; dx < dx2; dx++) {
+            int sx = dx * factor;
+            int blockWidth = min(factor, srcWidth - sx);
+
+            uint32_t sum[4];
+            sumBlock(src + size_t(sy) * srcWidth + sx, srcWidth, blockWidth, blockHeight, sum);
+
+            uint32_t count = uint32_t(blockWidth) * blockHeight;
+            uint32_t half = count / 2;
+
+            pixels[size_t(dy) * dstWidth + dx] = ((sum[0] + half) / count)
+                | (((sum[1] + half) / count) << 8)
+                | (((sum[2] + half) / count) << 16)
+                | (((sum[3] + half) / count) << 24);
+        }
+    }
+}
+
+
+/* ------------ JPEG ------------ */
+
+
+struct JpegErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+
+static void jpegErrorExit(j_common_ptr cinfo) {
+    char msg[JMSG_LENGTH_MAX];
+    cinfo->err->format_message(cinfo, msg);
+    LOG_WARN("failed to encode thumbnail: ", msg);
+
+    longjmp(((JpegErrorManager*) cinfo->err)->jump, 1);
+}
+
+
+bool Thumbnail::encodeJpeg(string& out) {
+    jpeg_compress_struct cinfo;
+    JpegErrorManager err;
+    unsigned char* buf = nullptr;
+    unsigned long size = 0;
+
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = jpegErrorExit;
+
+    if (setjmp(err.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        free(buf);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buf, &size);
+
+    cinfo.image_width = dstWidth;
+    cinfo.image_height = dstHeight;
+
+    // 像素在内存中按 B、G、R、X 排列。
+
+#ifdef JCS_EXTENSIONS
+    cinfo.input_components = 4;
+    cinfo.in_color_space = JCS_EXT_BGRX;
+#else
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+#endif
+
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, clamp(quality, 1, 100), TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        uint32_t* row = pixels.data() + size_t(cinfo.next_scanline) * dstWidth;
+
+#ifdef JCS_EXTENSIONS
+        JSAMPROW rowPtr = (JSAMPROW) row;
+#else
+        for (int x = 0; x < dstWidth; x++) {
+            rowBuffer[x * 3] = (row[x] >> 16) & 0xFF;
+            rowBuffer[x * 3 + 1] = (row[x] >> 8) & 0xFF;
+            rowBuffer[x * 3 + 2] = row[x] & 0xFF;
+        }
+
+        JSAMPROW rowPtr = rowBuffer.data();
+#endif
+
+        jpeg_write_scanlines(&cinfo, &rowPtr, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    out.assign((const char*) buf, size);
+    free(buf);
+
+    return true;
+}
+
+
+} // namespace vesper::vnc
@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 画面缩略图
+ *
+ * 创建于 2026年10月18日
+ *
+ * 维护一张常驻的缩小画面，只按 damage 重新计算变化的部分（整数倍盒式滤波），
+ * 并按设定帧率压缩为 JPEG，供 control 模块取用。
+ * 适合监控面板同时显示大量桌面的场景，不必为每个桌面都建立全分辨率 VNC 连接。
+ */
+
+#pragma once
+
+#include "../common/TileBitmap.h"
+
+#include <vector>
+#include <string>
+#include <semaphore>
+#include <cstdint>
+
+namespace vesper::vnc {
+
+class Thumbnail {
+
+public:
+
+    /**
+     * 设置源画面尺寸和缩略图的最大尺寸。缩放倍数取能放进最大尺寸的最小整数。
+     * 会使整张缩略图重新计算。
+     */
+    void resize(int srcWidth, int srcHeight, int maxWidth, int maxHeight);
+
+    int width() const { return dstWidth; }
+    int height() const { return dstHeight; }
+
+    /**
+     * 累积源画面的 damage。
+     */
+    void addDamage(const vesper::common::TileBitmap& damage);
+
+    /**
+     * 距离上次刷新是否已超过 1 / frameRate 秒。此时需要新画面。
+     */
+    bool due(int64_t nowNsec) const;
+
+    /**
+     * 距离上次刷新已超过 1 / frameRate 秒且有变化时，重新缩放变化的部分并压缩为 JPEG。
+     * 到了刷新时间但没有变化时，只重新开始计时。
+     *
+     * @param pixels 源画面。32 位像素，每行 srcWidth 个像素，紧密排列。
+     * @return 是否产生了新的 JPEG。
+     */
+    bool refresh(const uint32_t* pixels, int64_t nowNsec);
+
+    /**
+     * 取出最新的 JPEG。可以在其他线程调用。
+     *
+     * @return 还没有生成过 JPEG 时返回 false。
+     */
+    bool latestJpeg(std::string& out);
+
+public:
+
+    int frameRate = 1;
+
+    /** JPEG 质量（1-100）。 */
+    int quality = 70;
+
+protected:
+
+    /**
+     * 重新计算缩略图中 [dx1, dx2) x [dy1, dy2) 范围内的像素。
+     */
+    void downscale(const uint32_t* pixels, int dx1, int dy1, int dx2, int dy2);
+
+    bool encodeJpeg(std::string& out);
+
+protected:
+
+    int srcWidth = 0;
+    int srcHeight = 0;
+    int dstWidth = 0;
+    int dstHeight = 0;
+
+    /** 缩小倍数。缩略图的每个像素是源画面 factor x factor 个像素的平均值。 */
+    int factor = 1;
+
+    std::vector<uint32_t> pixels;
+
+    /** 自上次刷新以来源画面中变化的块。 */
+    vesper::common::TileBitmap dirty;
+
+    int64_t lastRefreshNsec = 0;
+
+    /** JPEG 编码时转换像素格式用的一行缓冲。 */
+    std::vector<uint8_t> rowBuffer;
+
+    struct {
+        std::string data;
+        std::binary_semaphore lock {1};
+    } jpeg;
+
+};
+
+} // namespace vesper::vnc
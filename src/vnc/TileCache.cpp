@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 客户端分块缓存
+ *
+ * 创建于 2026年10月18日
+ */
+
+#include "./TileCache.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace vesper::vnc {
+
+
+void TileCache::setCapacity(int capacity) {
+    slots = max(capacity, 0);
+    clear();
+}
+
+
+int TileCache::lookup(const TileHasher::Hash& hash) {
+    auto it = index.find(hash);
+    if (it == index.end()) {
+        return -1;
+    }
+
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->slot;
+}
+
+
+int TileCache::insert(const TileHasher::Hash& hash) {
+    int slot = lookup(hash);
+    if (slot >= 0) {
+        return slot;
+    }
+
+    if (int(entries.size()) < slots) {
+        slot = int(entries.size());
+    } else {
+        auto& victim = entries.back();
+        slot = victim.slot;
+        index.erase(victim.hash);
+        entries.pop_back();
+    }
+
+    entries.push_front({ .hash = hash, .slot = slot });
+    index[hash] = entries.begin();
+
+    return slot;
+}
+
+
+void TileCache::clear() {
+    entries.clear();
+    index.clear();
+}
+
+
+} // namespace vesper::vnc
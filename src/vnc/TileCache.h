@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 客户端分块缓存
+ *
+ * 创建于 2026年10月18日
+ *
+ * 记录某个客户端手上保存着哪些 64x64 块，以内容哈希为键，按 LRU 淘汰。
+ * 客户端只需按槽位号保存块，不需要自己计算哈希。
+ *
+ * 协议（均为 FramebufferUpdate 中的矩形，数值按网络字节序）：
+ *   客户端在 SetEncodings 中声明 PSEUDO_ENCODING 以启用。
+ *   ENCODING_STORE：矩形后跟 u32 槽位号。客户端把自己画面上该矩形内的像素存入此槽位。
+ *   ENCODING_HIT：  矩形后跟 u32 槽位号。客户端把此槽位的像素画到该矩形。
+ *   这些矩形与普通矩形放在同一条更新中，以 LastRect 结尾，客户端按顺序处理。
+ */
+
+#pragma once
+
+#include "./TileHasher.h"
+
+#include <list>
+#include <unordered_map>
+#include <cstdint>
+
+namespace vesper::vnc {
+
+class TileCache {
+
+public:
+
+    static constexpr int32_t PSEUDO_ENCODING = 0x56455350;
+    static constexpr int32_t ENCODING_STORE = 0x56455351;
+    static constexpr int32_t ENCODING_HIT = 0x56455352;
+
+    /**
+     * 设置最多保存的块数。会清空已有记录。0 表示不启用。
+     */
+    void setCapacity(int capacity);
+    int capacity() const { return slots; }
+
+    /**
+     * 查找内容为 hash 的块。命中时将其标记为最近使用。
+     *
+     * @return 槽位号。未命中时返回 -1。
+     */
+    int lookup(const TileHasher::Hash& hash);
+
+    /**
+     * 记录客户端即将保存内容为 hash 的块。已满时淘汰最久未使用的块，复用其槽位。
+     *
+     * @return 客户端应保存到的槽位号。
+     */
+    int insert(const TileHasher::Hash& hash);
+
+    void clear();
+
+protected:
+
+    struct Entry {
+        TileHasher::Hash hash;
+        int slot;
+    };
+
+    struct HashOf {
+        size_t operator () (const TileHasher::Hash& hash) const {
+            return size_t(hash.low);
+        }
+    };
+
+protected:
+
+    int slots = 0;
+
+    /** 越靠前越是最近使用的。 */
+    std::list<Entry> entries;
+    std::unordered_map<TileHasher::Hash, std::list<Entry>::iterator, HashOf> index;
+
+};
+
+} // namespace vesper::vnc
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 画面分块变化统计
+ *
+ * 创建于 2026年10月18日
+ */
+
+#include "./TileChangeStats.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace vesper::bindings;
+
+namespace vesper::vnc {
+
+
+void TileChangeStats::resize(int width, int height) {
+    this->width = max(width, 0);
+    this->height = max(height, 0);
+
+    columns = (this->width + TILE_SIZE - 1) / TILE_SIZE;
+    rows = (this->height + TILE_SIZE - 1) / TILE_SIZE;
+
+    tiles.assign(size_t(columns) * rows, Tile());
+    videoBits.resize(this->width, this->height);
+    video.clear();
+}
+
+
+void TileChangeStats::update(const common::TileBitmap& damage, int64_t nowNsec) {
+    if (tiles.empty() || damage.columns() != columns || damage.rows() != rows) {
+        return;
+    }
+
+    bool changed = false;
+
+    // 累计本帧被触碰的块。
+
+    damage.forEachRun([&] (int row, int column, int end) {
+        for (; column < end; column++) {
+            Tile& tile = tiles[size_t(row) * columns + column];
+            tile.lastChangeNsec = nowNsec;
+
+            if (nowNsec - tile.windowStartNsec > promoteWindowNsec) {
+                tile.windowStartNsec = nowNsec;
+                tile.changes = 0;
+            }
+
+            tile.changes++;
+
+            if (!tile.video && tile.changes >= promoteChanges) {
+                tile.video = true;
+                changed = true;
+            }
+        }
+    });
+
+    // 静止足够久的视频块恢复为普通块。
+
+    for (auto& tile : tiles) {
+        if (tile.video && nowNsec - tile.lastChangeNsec > demoteIdleNsec) {
+            tile.video = false;
+            tile.changes = 0;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        rebuildVideoRegion();
+    }
+}
+
+
+void TileChangeStats::rebuildVideoRegion() {
+    videoBits.clear();
+
+    for (int row = 0; row < rows; row++) {
+        for (int column = 0; column < columns; column++) {
+            if (tiles[size_t(row) * columns + column].video) {
+                videoBits.set(column, row);
+            }
+        }
+    }
+
+    videoBits.toRegion(video);
+}
+
+
+} // namespace vesper::vnc
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 画面分块变化统计
+ *
+ * 创建于 2026年10月18日
+ *
+ * 把画面切成固定大小的块，统计每块的变化频率。
+ * 持续变化的块被视为视频区域，静止一段时间后再恢复为普通区域。
+ * 用于没有声明 content-type 的客户端。
+ */
+
+#pragma once
+
+#include "../common/TileBitmap.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace vesper::vnc {
+
+class TileChangeStats {
+
+public:
+
+    static constexpr int TILE_SIZE = 64;
+    static_assert(TILE_SIZE == vesper::common::TileBitmap::TILE_SIZE);
+
+    /**
+     * 设置画面尺寸。会清空已有统计。
+     */
+    void resize(int width, int height);
+
+    /**
+     * 记录一帧的 damage。
+     *
+     * @param nowNsec 当前时间（纳秒，CLOCK_MONOTONIC）。
+     */
+    void update(const vesper::common::TileBitmap& damage, int64_t nowNsec);
+
+    /**
+     * 当前被判定为视频的块组成的区域。
+     */
+    const vesper::bindings::pixman::Region32& videoRegion() const { return video; }
+
+    /**
+     * 当前被判定为视频的块。
+     */
+    const vesper::common::TileBitmap& videoTiles() const { return videoBits; }
+
+public:
+
+    /** 在 promoteWindowNsec 内变化这么多次，块被判定为视频。 */
+    int promoteChanges = 8;
+    int64_t promoteWindowNsec = 1000000000;
+
+    /** 视频块静止这么久后，恢复为普通块。 */
+    int64_t demoteIdleNsec = 2000000000;
+
+protected:
+
+    struct Tile {
+        int64_t lastChangeNsec = 0;
+        int64_t windowStartNsec = 0;
+        int changes = 0;
+        bool video = false;
+    };
+
+    void rebuildVideoRegion();
+
+protected:
+
+    std::vector<Tile> tiles;
+    int columns = 0;
+    int rows = 0;
+    int width = 0;
+    int height = 0;
+
+    vesper::common::TileBitmap videoBits;
+    vesper::bindings::pixman::Region32 video;
+
+};
+
+} // namespace vesper::vnc
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 画面分块哈希
+ *
+ * 创建于 2026年10月18日
+ *
+ * 哈希算法参考 XXH3 的累加与扰动步骤：
+ * 每 16 字节与密钥异或后做 32x32 位乘法累加，每行结束时扰动一次。
+ * SSE2 版本与标量版本的计算结果完全相同。
+ */
+
+#include "./TileHasher.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace vesper::vnc {
+
+
+static const uint64_t PRIME32_1 = 0x9E3779B1u;
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ull;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+
+static const int KEY_COUNT = 8;
+
+/** 每组 16 字节，对应一次累加所用的两个 64 位密钥。 */
+alignas(16) static const uint64_t KEYS[KEY_COUNT][2] = {
+    { 0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull },
+    { 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull },
+    { 0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull },
+    { 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull },
+    { 0xcb00c391bb52283cull, 0xa32e531b8b65d088ull },
+    { 0x4ef90da297486471ull, 0xd8acdea946ef1938ull },
+    { 0x3f349ce33f76faa8ull, 0x1d4f0bc7c7bbdcf9ull },
+    { 0x3159b4cd4be0518aull, 0x647378d9c97e9fc8ull },
+};
+
+
+static inline uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ull;
+    h ^= h >> 32;
+    return h;
+}
+
+
+static TileHasher::Hash finish(const uint64_t acc[4], int width, int height) {
+    uint64_t length = (uint64_t(width) << 32) | uint32_t(height);
+
+    return {
+        .low = avalanche(acc[0] + acc[3] + length * PRIME64_1),
+        .high = avalanche(acc[1] ^ acc[2] ^ (length * PRIME64_2))
+    };
+}
+
+
+#if defined(__SSE2__)
+
+
+static inline __m128i accumulate(__m128i acc, __m128i data, __m128i key) {
+    __m128i dataKey = _mm_xor_si128(data, key);
+    __m128i dataKeyHigh = _mm_srli_epi64(dataKey, 32);
+    __m128i product = _mm_mul_epu32(dataKey, dataKeyHigh);
+    __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm_add_epi64(acc, _mm_add_epi64(swapped, product));
+}
+
+
+static inline __m128i scramble(__m128i acc, __m128i key) {
+    acc = _mm_xor_si128(acc, _mm_srli_epi64(acc, 47));
+    acc = _mm_xor_si128(acc, key);
+
+    const __m128i prime = _mm_set1_epi32(int(PRIME32_1));
+    __m128i low = _mm_mul_epu32(acc, prime);
+    __m128i high = _mm_mul_epu32(_mm_srli_epi64(acc, 32), prime);
+    return _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+}
+
+
+TileHasher::Hash TileHasher::hash(const uint32_t* pixels, int stride, int width, int height) {
+    __m128i acc[2] = {
+        _mm_set_epi64x(PRIME64_2, PRIME64_1),
+        _mm_set_epi64x(PRIME64_1, PRIME64_2)
+    };
+
+    for (int y = 0; y < height; y++) {
+        const uint32_t* row = pixels + size_t(y) * stride;
+
+        int chunk = 0;
+        int x = 0;
+        for (; x + 4 <= width; x += 4, chunk++) {
+            __m128i data = _mm_loadu_si128((const __m128i*) (row + x));
+            __m128i key = _mm_load_si128((const __m128i*) KEYS[chunk % KEY_COUNT]);
+            acc[chunk & 1] = accumulate(acc[chunk & 1], data, key);
+        }
+
+        if (x < width) {
+            alignas(16) uint32_t tail[4] = {0};
+            memcpy(tail, row + x, (width - x) * sizeof(uint32_t));
+            __m128i data = _mm_load_si128((const __m128i*) tail);
+            __m128i key = _mm_load_si128((const __m128i*) KEYS[chunk % KEY_COUNT]);
+            acc[chunk & 1] = accumulate(acc[chunk & 1], data, key);
+        }
+
+        __m128i rowKey = _mm_load_si128((const __m128i*) KEYS[y % KEY_COUNT]);
+        acc[0] = scramble(acc[0], rowKey);
+        acc[1] = scramble(acc[1], rowKey);
+    }
+
+    alignas(16) uint64_t lanes[4];
+    _mm_store_si128((__m128i*) lanes, acc[0]);
+    _mm_store_si128((__m128i*) (lanes + 2), acc[1]);
+
+    return finish(lanes, width, height);
+}
+
+
+#else  // defined(__SSE2__)
+
+
+static inline void accumulate(uint64_t acc[2], const uint64_t data[2], const uint64_t key[2]) {
+    for (int i = 0; i < 2; i++) {
+        uint64_t dataKey = data[i] ^ key[i];
+        uint64_t product = (dataKey & 0xFFFFFFFFull) * (dataKey >> 32);
+        acc[i] += data[i ^ 1] + product;
+    }
+}
+
+
+static inline void scramble(uint64_t acc[2], const uint64_t key[2]) {
+    for (int i = 0; i < 2; i++) {
+        acc[i] ^= acc[i] >> 47;
+        acc[i] ^= key[i];
+        acc[i] *= PRIME32_1;
+    }
+}
+
+
+TileHasher::Hash TileHasher::hash(const uint32_t* pixels, int stride, int width, int height) {
+    uint64_t acc[4] = { PRIME64_1, PRIME64_2, PRIME64_2, PRIME64_1 };
+
+    for (int y = 0; y < height; y++) {
+        const uint32_t* row = pixels + size_t(y) * stride;
+
+        int chunk = 0;
+        for (int x = 0; x < width; x += 4, chunk++) {
+            uint64_t data[2] = {0, 0};
+            memcpy(data, row + x, min(width - x, 4) * sizeof(uint32_t));
+            accumulate(acc + (chunk & 1) * 2, data, KEYS[chunk % KEY_COUNT]);
+        }
+
+        scramble(acc, KEYS[y % KEY_COUNT]);
+        scramble(acc + 2, KEYS[y % KEY_COUNT]);
+    }
+
+    return finish(acc, width, height);
+}
+
+
+#endif  // defined(__SSE2__)
+
+
+void TileHasher::resize(int width, int height) {
+    this->width = max(width, 0);
+    this->height = max(height, 0);
+
+    columns = (this->width + TILE_SIZE - 1) / TILE_SIZE;
+    rows = (this->height + TILE_SIZE - 1) / TILE_SIZE;
+
+    tiles.assign(size_t(columns) * rows, Tile());
+}
+
+
+void TileHasher::reset() {
+    for (auto& tile : tiles) {
+        tile.valid = false;
+    }
+}
+
+
+void TileHasher::filterDamage(const uint32_t* pixels, common::TileBitmap& damage) {
+    if (tiles.empty() || damage.columns() != columns || damage.rows() != rows) {
+        return;
+    }
+
+    damage.forEachRun([&] (int row, int column, int end) {
+        for (; column < end; column++) {
+            Tile& tile = tiles[size_t(row) * columns + column];
+
+            int x = column * TILE_SIZE;
+            int y = row * TILE_SIZE;
+            int tileWidth = min(TILE_SIZE, width - x);
+            int tileHeight = min(TILE_SIZE, height - y);
+
+            Hash h = hash(pixels + size_t(y) * width + x, width, tileWidth, tileHeight);
+
+            if (tile.valid && tile.hash == h) {
+                damage.reset(column, row);
+            }
+
+            tile.hash = h;
+            tile.valid = true;
+        }
+    });
+}
+
+
+bool TileHasher::tileHash(int column, int row, Hash& hash) const {
+    if (column < 0 || column >= columns || row < 0 || row >= rows) {
+        return false;
+    }
+
+    const Tile& tile = tiles[size_t(row) * columns + column];
+    hash = tile.hash;
+    return tile.valid;
+}
+
+
+} // namespace vesper::vnc
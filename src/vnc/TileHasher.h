@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 画面分块哈希
+ *
+ * 创建于 2026年10月18日
+ *
+ * 为画面的每个 64x64 块计算 128 位哈希，并与上一帧比较。
+ * 内容没有变化的块会从 damage 中剔除。
+ * 不少客户端每次提交都 damage 整个窗口，实际只改了几个像素。
+ */
+
+#pragma once
+
+#include "../common/TileBitmap.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace vesper::vnc {
+
+class TileHasher {
+
+public:
+
+    static constexpr int TILE_SIZE = 64;
+    static_assert(TILE_SIZE == vesper::common::TileBitmap::TILE_SIZE);
+
+    struct Hash {
+        uint64_t low;
+        uint64_t high;
+
+        bool operator == (const Hash& other) const {
+            return low == other.low && high == other.high;
+        }
+    };
+
+    /**
+     * 设置画面尺寸。会清空已有哈希。
+     */
+    void resize(int width, int height);
+
+    /**
+     * 使所有已记录的哈希失效。下一次 filterDamage 不会剔除任何块。
+     */
+    void reset();
+
+    /**
+     * 重新计算 damage 触及的块的哈希，把内容没有变化的块从 damage 中剔除。
+     *
+     * @param pixels 32 位像素，每行 width 个像素，紧密排列。
+     * @param damage 分块大小须与 TILE_SIZE 一致。
+     */
+    void filterDamage(const uint32_t* pixels, vesper::common::TileBitmap& damage);
+
+    /**
+     * 块的最新哈希。
+     *
+     * @return 该块还没有被计算过时返回 false。
+     */
+    bool tileHash(int column, int row, Hash& hash) const;
+
+    /**
+     * 计算一块像素的哈希。
+     *
+     * @param stride 每行的像素个数。
+     */
+    static Hash hash(const uint32_t* pixels, int stride, int width, int height);
+
+protected:
+
+    struct Tile {
+        Hash hash = {0, 0};
+        bool valid = false;
+    };
+
+protected:
+
+    std::vector<Tile> tiles;
+    int columns = 0;
+    int rows = 0;
+    int width = 0;
+    int height = 0;
+
+};
+
+} // namespace vesper::vnc
@@ -0,0 +1,222 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 零拷贝发送
+ *
+ * 创建于 2026年10月18日
+ */
+
+#include "./ZeroCopySender.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <errno.h>
+#include <climits>
+#include <algorithm>
+
+#ifndef SO_ZEROCOPY
+    #define SO_ZEROCOPY 60
+#endif
+
+#ifndef MSG_ZEROCOPY
+    #define MSG_ZEROCOPY 0x4000000
+#endif
+
+using namespace std;
+
+namespace vesper::vnc {
+
+
+bool ZeroCopySender::enable(int fd) {
+    int one = 1;
+    zeroCopyEnabled = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+    return zeroCopyEnabled;
+}
+
+
+bool ZeroCopySender::send(
+    int fd, 
+    const vector<Segment>& segments, 
+    vector<shared_ptr<const void>>&& keepAlive,
+    int timeoutMs
+) {
+    uint32_t firstId = nextId;
+
+    size_t segmentIdx = 0;
+    size_t segmentOffset = 0;
+    bool success = true;
+    bool copyNext = false;
+
+    while (segmentIdx < segments.size()) {
+
+        // 从当前位置开始，至多 IOV_MAX 段。
+
+        vector<iovec> iov;
+        for (size_t i = segmentIdx; i < segments.size() && iov.size() < IOV_MAX; i++) {
+            size_t offset = i == segmentIdx ? segmentOffset : 0;
+            iov.push_back({
+                .iov_base = (void*) (segments[i].data + offset),
+                .iov_len = segments[i].length - offset
+            });
+        }
+
+        msghdr msg {};
+        msg.msg_iov = iov.data();
+        msg.msg_iovlen = iov.size();
+
+        int flags = copyNext ? MSG_NOSIGNAL : MSG_ZEROCOPY | MSG_NOSIGNAL;
+        ssize_t bytes = sendmsg(fd, &msg, flags);
+
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // 锁定的用户内存超过 optmem 上限。此时 socket 仍然可写，等 POLLOUT 会空转，
+            // 先释放已完成的发送，这一次改用普通方式拷贝发送。
+
+            if (errno == ENOBUFS && !copyNext) {
+                reap(fd);
+                copyNext = true;
+                stats.noBuffers++;
+                continue;
+            }
+
+            // socket 缓冲区腾出空间之前，暂时无法发送。
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                reap(fd);
+
+                pollfd pfd = { .fd = fd, .events = POLLOUT, .revents = 0 };
+                if (poll(&pfd, 1, timeoutMs) > 0) {
+                    continue;
+                }
+            }
+
+            success = false;
+            break;
+        }
+
+        // 只有 MSG_ZEROCOPY 调用会占用编号。
+
+        if (copyNext) {
+            copyNext = false;
+        } else {
+            nextId++;
+        }
+
+        // 前进 bytes 字节。
+
+        size_t remaining = size_t(bytes);
+        while (remaining > 0 && segmentIdx < segments.size()) {
+            size_t available = segments[segmentIdx].length - segmentOffset;
+            if (remaining < available) {
+                segmentOffset += remaining;
+                remaining = 0;
+            } else {
+                remaining -= available;
+                segmentIdx++;
+                segmentOffset = 0;
+            }
+        }
+
+        while (segmentIdx < segments.size() && segments[segmentIdx].length == 0) {
+            segmentIdx++;
+        }
+    }
+
+    if (nextId != firstId) {
+        pending.push_back({
+            .firstId = firstId,
+            .endId = nextId,
+            .keepAlive = std::move(keepAlive)
+        });
+    }
+
+    return success;
+}
+
+
+void ZeroCopySender::reap(int fd) {
+    if (pending.empty()) {
+        return;
+    }
+
+    char control[128];
+
+    while (true) {
+        msghdr msg {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;  // EAGAIN：暂时没有更多通知。
+        }
+
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            bool isRecvErr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+
+            if (!isRecvErr) {
+                continue;
+            }
+
+            auto* err = (sock_extended_err*) CMSG_DATA(cm);
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            uint32_t lo = err->ee_info;
+            uint32_t hi = err->ee_data;
+
+            uint64_t count = uint64_t(hi - lo) + 1;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                stats.copied += count;
+            } else {
+                stats.zeroCopied += count;
+            }
+
+            auto& it = completedRanges[lo];
+            it = max(it, hi);
+        }
+    }
+
+    releaseCompleted();
+}
+
+
+void ZeroCopySender::releaseCompleted() {
+
+    // 把与 completedBelow 相连的区间合并进来。编号会回绕，一律用差值比较。
+
+    bool merged = true;
+    while (merged) {
+        merged = false;
+
+        for (auto it = completedRanges.begin(); it != completedRanges.end(); ) {
+            uint32_t lo = it->first;
+            uint32_t hi = it->second;
+
+            if (int32_t(lo - completedBelow) <= 0) {
+                if (int32_t(hi + 1 - completedBelow) > 0) {
+                    completedBelow = hi + 1;
+                    merged = true;
+                }
+
+                it = completedRanges.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    while (!pending.empty() && int32_t(pending.front().endId - completedBelow) <= 0) {
+        pending.pop_front();
+    }
+}
+
+
+} // namespace vesper::vnc
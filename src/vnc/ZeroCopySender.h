@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: MulanPSL-2.0
+
+/*
+ * 零拷贝发送
+ *
+ * 创建于 2026年10月18日
+ *
+ * 用 MSG_ZEROCOPY 把多段数据直接从用户态缓冲发送出去，省去拷入内核的一次 memcpy。
+ * 内核可能在 send 返回后很久才读取这些内存，因此每次发送都持有各段缓冲的引用，
+ * 直到从 socket 的错误队列收到完成通知才释放。
+ *
+ * 只适用于普通 TCP 连接。WebSocket、TLS 需要改写数据，不能使用。
+ */
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace vesper::vnc {
+
+class ZeroCopySender {
+
+public:
+
+    /** 小于此大小的消息拷贝开销很小，不值得零拷贝。 */
+    static constexpr size_t MIN_MESSAGE_SIZE = 64 * 1024;
+
+    struct Segment {
+        const char* data;
+        size_t length;
+    };
+
+    /**
+     * 为 socket 开启 SO_ZEROCOPY。
+     * 
+     * @return 内核不支持时返回 false。
+     */
+    bool enable(int fd);
+
+    bool enabled() const { return zeroCopyEnabled; }
+
+    /**
+     * 发送 segments，直到全部写入 socket 或出错。socket 可以是非阻塞的。
+     *
+     * @param keepAlive segments 所指向内存的所有者。会被持有到内核释放这些内存为止。
+     * @param timeoutMs 等待 socket 可写的最长时间。
+     * @return 出错或超时时返回 false，连接应被关闭。
+     */
+    bool send(
+        int fd, 
+        const std::vector<Segment>& segments, 
+        std::vector<std::shared_ptr<const void>>&& keepAlive,
+        int timeoutMs
+    );
+
+    /**
+     * 读取完成通知，释放内核已不再使用的缓冲。
+     */
+    void reap(int fd);
+
+    /** 还在等待完成通知的发送次数。 */
+    size_t pendingCount() const { return pending.size(); }
+
+    struct {
+        uint64_t zeroCopied = 0;
+
+        /** 内核退回到拷贝方式发送的次数（例如发往本机回环的连接）。 */
+        uint64_t copied = 0;
+
+        /** 因 ENOBUFS 改用普通 sendmsg 的次数。 */
+        uint64_t noBuffers = 0;
+    } stats;
+
+protected:
+
+    struct Pending {
+        /** 本次发送涉及的 sendmsg 调用编号，[firstId, endId)。 */
+        uint32_t firstId;
+        uint32_t endId;
+        std::vector<std::shared_ptr<const void>> keepAlive;
+    };
+
+    void releaseCompleted();
+
+protected:
+
+    bool zeroCopyEnabled = false;
+
+    /** 下一次成功的 MSG_ZEROCOPY 调用会得到的编号。内核从 0 开始计数。 */
+    uint32_t nextId = 0;
+
+    /** 编号小于此值的调用都已完成。 */
+    uint32_t completedBelow = 0;
+
+    /** 乱序到达、尚未与 completedBelow 连上的完成区间。[lo, hi] */
+    std::map<uint32_t, uint32_t> completedRanges;
+
+    std::deque<Pending> pending;
+
+};
+
+} // namespace vesper::vnc